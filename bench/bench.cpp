@@ -0,0 +1,217 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../src/interpreter.hpp"
+#include "../src/module.hpp"
+
+// Benchmark runner behind make bench.
+// Every benchmark runs in a forked child so allocation counts and peak
+// RSS are its own. Results are printed as one JSON object per line:
+// {"name", "kind", "ops", "seconds", "ops_per_sec", "allocations", "peak_rss_kb"}
+
+// Runs one batch of the benchmark and returns the number of operations done
+using BenchFunction = std::function<uint64_t()>;
+
+// Setup runs in the child as well, so it is not shared between benchmarks
+struct Benchmark {
+    std::string name;
+    std::string kind;
+    std::function<BenchFunction()> setup;
+};
+
+double min_seconds = 1.0;
+
+std::string read_file(const std::string& path) {
+    std::ifstream file(path);
+    if(!file) throw std::runtime_error("Could not open " + path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+// Repeat the batch until min_seconds have passed, then report from the child
+void measure(const Benchmark& bench) {
+    using clock = std::chrono::steady_clock;
+    auto batch = bench.setup();
+
+    // Warm up once, outside of the measurement
+    batch();
+
+    uint64_t allocations = pfix_alloc_stats().allocations;
+    uint64_t ops = 0;
+    auto start = clock::now();
+    double seconds = 0;
+    do {
+        ops += batch();
+        seconds = std::chrono::duration<double>(clock::now() - start).count();
+    } while(seconds < min_seconds);
+    allocations = pfix_alloc_stats().allocations - allocations;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::cout << "{\"name\": \"" << bench.name << "\""
+        << ", \"kind\": \"" << bench.kind << "\""
+        << ", \"ops\": " << ops
+        << ", \"seconds\": " << seconds
+        << ", \"ops_per_sec\": " << ops / seconds
+        << ", \"allocations\": " << allocations
+        << ", \"peak_rss_kb\": " << usage.ru_maxrss
+        << "}" << std::endl;
+}
+
+bool run_isolated(const Benchmark& bench) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if(pid < 0) {
+        std::cerr << "Could not fork: " << std::strerror(errno) << std::endl;
+        return false;
+    } else if(pid == 0) {
+        try {
+            measure(bench);
+        } catch(const std::exception& e) {
+            std::cerr << bench.name << ": Error: " << e.what() << std::endl;
+            std::_Exit(1);
+        }
+        std::cout.flush();
+        std::_Exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Whole programs, each batch runs the program once in a fresh interpreter
+Benchmark program(const std::string& dir, const std::string& name) {
+    return {name, "program", [dir, name]() -> BenchFunction {
+        auto source = std::make_shared<std::string>(read_file(dir + "/" + name + ".pf"));
+        return [source]() {
+            PfixInterpreter interp;
+            interp.load_builtins();
+            PfixModule module;
+            module.compile(*source, *interp.scope);
+            module.run(interp);
+            return uint64_t(1);
+        };
+    }};
+}
+
+Benchmark startup() {
+    return {"startup", "program", []() -> BenchFunction {
+        return []() {
+            PfixInterpreter interp;
+            interp.load_builtins();
+            return uint64_t(1);
+        };
+    }};
+}
+
+// Tokens per second over a mix of literals and symbols
+Benchmark lexer_next() {
+    return {"lexer_next", "micro", []() -> BenchFunction {
+        auto source = std::make_shared<std::string>();
+        for(int i = 0; i < 1000; i++) {
+            *source += "fib: (n :Int -> :Int) { n 1 <= { 1 } { n 1 - fib n 2 - fib + } if } fun ";
+            *source += "\"some string\" 3.25 true [ 1 2 3 ] println\n";
+        }
+
+        return [source]() {
+            Lexer lexer(*source);
+            Token token;
+            uint64_t tokens = 0;
+            while(lexer.next(token) != TokenType::EOL) tokens++;
+            return tokens;
+        };
+    }};
+}
+
+// Values pushed per second at the top level: 1 2 + repeated
+Benchmark interpreter_push() {
+    return {"interpreter_push", "micro", []() -> BenchFunction {
+        auto interp = std::make_shared<PfixInterpreter>();
+        interp->load_builtins();
+        auto plus = intern("+");
+
+        return [interp, plus]() {
+            for(int i = 0; i < 10000; i++) {
+                interp->push(Value(1));
+                interp->push(Value(2));
+                interp->push(std::make_unique<Sym>(plus));
+            }
+            interp->stack.clear();
+            return uint64_t(30000);
+        };
+    }};
+}
+
+// Lookups per second of builtins and globals through a chain of scopes
+Benchmark dictionary_lookup() {
+    return {"dictionary_lookup", "micro", []() -> BenchFunction {
+        auto interp = std::make_shared<PfixInterpreter>();
+        interp->load_builtins();
+        for(int i = 0; i < 64; i++) {
+            interp->globals->bindings["global-" + std::to_string(i)] = Value(i);
+        }
+
+        auto ids = std::make_shared<std::vector<SymbolId>>();
+        interp->globals->bindings.for_each([&](SymbolId id, const PfixDictionary::Binding&) {
+            ids->push_back(id);
+        });
+        auto inner = std::make_shared<PfixScope>(std::make_shared<PfixScope>(interp->globals));
+
+        return [interp, inner, ids]() {
+            size_t found = 0;
+            for(int i = 0; i < 1000; i++) {
+                for(auto id : *ids) found += inner->lookup(id) != nullptr;
+            }
+            if(found != 1000 * ids->size()) throw std::runtime_error("Lookup failed");
+            return uint64_t(found);
+        };
+    }};
+}
+
+void usage() {
+    std::cerr << "Usage: bench [--dir programs] [--seconds s] [name...]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string dir = "bench/programs";
+    std::vector<std::string> filter;
+
+    for(int i = 1; i < argc; i++) {
+        if(std::strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if(std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            min_seconds = std::atof(argv[++i]);
+        } else if(argv[i][0] == '-') {
+            usage();
+            return 2;
+        } else {
+            filter.push_back(argv[i]);
+        }
+    }
+
+    std::vector<Benchmark> benchmarks;
+    for(auto name : {"fib", "loop", "counting", "strings", "arrays", "closures"}) {
+        benchmarks.push_back(program(dir, name));
+    }
+    benchmarks.push_back(startup());
+    benchmarks.push_back(lexer_next());
+    benchmarks.push_back(interpreter_push());
+    benchmarks.push_back(dictionary_lookup());
+
+    int status = 0;
+    for(auto& bench : benchmarks) {
+        if(!filter.empty() && std::find(filter.begin(), filter.end(), bench.name) == filter.end()) continue;
+        if(!run_isolated(bench)) status = 1;
+    }
+    return status;
+}
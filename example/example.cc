@@ -1,24 +1,63 @@
-#include "../src/types.hpp"
+#include "../src/extension.h"
 
-int fib(int n) {
+#include <cctype>
+#include <string>
+
+// Functions of the interpreter, set by the entry point
+static const PfixHost* host;
+
+int64_t fib(int64_t n) {
     if(n <= 1) return 1;
     else {
         return fib(n-2) + fib(n-1);
     }
 }
 
-void PfixFib(PfixStack* s) {
-    auto x = s->popInt();
-    s->pushInt(fib(x));
+// n fib
+void PfixFib(const PfixValue* args, PfixValue* result, PfixCall* call) {
+    result->i = fib(args[0].i);
 }
 
-extern "C" {
+// [ 1 2 3 ] sum-squares, reads the packed array in place
+void PfixSumSquares(const PfixValue* args, PfixValue* result, PfixCall* call) {
+    int64_t sum = 0;
+    for(size_t i = 0; i < args[0].int_arr.size; i++) {
+        int64_t x = args[0].int_arr.data[i];
+        if(__builtin_mul_overflow(x, x, &x) || __builtin_add_overflow(sum, x, &sum)) {
+            host->error(call, "sum does not fit into 64 bits");
+            return;
+        }
+    }
+    result->i = sum;
+}
 
-void PfixInitExample(PfixDictionary* dict) {
-    std::cout << "Hello" << std::endl;
-    //auto nsym = std::make_unique<NativeSym>(PfixFib);
+// [ 1.0 2.0 ] 0.5 scale
+void PfixScale(const PfixValue* args, PfixValue* result, PfixCall* call) {
+    double* out = host->result_flt_arr(call, args[0].flt_arr.size);
+    for(size_t i = 0; i < args[0].flt_arr.size; i++) {
+        out[i] = args[0].flt_arr.data[i] * args[1].f;
+    }
+}
 
-    dict->emplace("fib", std::make_unique<NativeSym>(PfixFib));
+// "text" shout
+void PfixShout(const PfixValue* args, PfixValue* result, PfixCall* call) {
+    if(args[0].str.size == 0) {
+        host->error(call, "nothing to shout");
+        return;
+    }
+    std::string str(args[0].str.data, args[0].str.size);
+    for(auto& c : str) c = std::toupper(c);
+    host->result_str(call, str.data(), str.size());
 }
 
-}
\ No newline at end of file
+PFIX_EXTENSION(Example) {
+    ::host = host;
+
+    const PfixNativeDef natives[] = {
+        {"fib", PfixFib, 1, {PFIX_INT}, PFIX_INT, PFIX_PURE},
+        {"sum-squares", PfixSumSquares, 1, {PFIX_INT_ARR}, PFIX_INT, PFIX_PURE},
+        {"scale", PfixScale, 2, {PFIX_FLT_ARR, PFIX_FLT}, PFIX_FLT_ARR, 0},
+        {"shout", PfixShout, 1, {PFIX_STR}, PFIX_STR, 0},
+    };
+    for(auto& def : natives) host->define(registry, &def);
+}
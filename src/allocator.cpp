@@ -0,0 +1,159 @@
+#include "allocator.hpp"
+
+#include <atomic>
+#include <new>
+
+namespace {
+
+constexpr size_t GRANULARITY = 16;
+constexpr size_t NUM_CLASSES = 16;
+constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// Every object is charged to the pool of the thread that allocated it.
+// Chunks are aligned to their size and start with a header naming that
+// pool, large objects carry the header in front of them. Objects freed on
+// another thread are pushed onto the remote lists of their pool, which
+// takes them back once its own lists run empty.
+struct Pool {
+    FreeBlock* free_lists[NUM_CLASSES] = {};
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    PfixAllocStats stats;
+
+    std::atomic<FreeBlock*> remote_lists[NUM_CLASSES] = {};
+    std::atomic<uint64_t> remote_objects{0};
+    std::atomic<uint64_t> remote_bytes{0};
+};
+
+struct alignas(GRANULARITY) Header {
+    Pool* owner;
+};
+
+// Pools outlive their threads, objects may still be freed afterwards
+thread_local Pool* local = nullptr;
+
+inline Pool& local_pool() {
+    if(local == nullptr) local = new Pool();
+    return *local;
+}
+
+inline size_t size_class(size_t size) {
+    return (size + GRANULARITY - 1) / GRANULARITY - 1;
+}
+
+inline Pool* chunk_owner(void* ptr) {
+    auto chunk = reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(CHUNK_SIZE - 1);
+    return reinterpret_cast<Header*>(chunk)->owner;
+}
+
+// Deallocations by other threads count once the owner reads its statistics
+void settle(Pool& pool) {
+    uint64_t objects = pool.remote_objects.exchange(0, std::memory_order_relaxed);
+    uint64_t bytes = pool.remote_bytes.exchange(0, std::memory_order_relaxed);
+    pool.stats.deallocations += objects;
+    pool.stats.live_objects -= objects;
+    pool.stats.live_bytes -= bytes;
+}
+
+void free_remote(Pool& owner, FreeBlock* block, size_t cls, size_t size) {
+    auto& list = owner.remote_lists[cls];
+    block->next = list.load(std::memory_order_relaxed);
+    while(!list.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed)) {}
+    owner.remote_bytes.fetch_add(size, std::memory_order_relaxed);
+    owner.remote_objects.fetch_add(1, std::memory_order_relaxed);
+}
+
+}
+
+void* pfix_allocate(size_t size) {
+    auto& pool = local_pool();
+    auto& stats = pool.stats;
+    stats.allocations++;
+    stats.live_objects++;
+    stats.live_bytes += size;
+    if(stats.live_bytes > stats.peak_bytes) stats.peak_bytes = stats.live_bytes;
+
+    size_t cls = size_class(size);
+    if(cls >= NUM_CLASSES) {
+        stats.large++;
+        auto header = static_cast<Header*>(::operator new(sizeof(Header) + size));
+        header->owner = &pool;
+        return header + 1;
+    }
+
+    auto block = pool.free_lists[cls];
+    if(block == nullptr && pool.remote_lists[cls].load(std::memory_order_relaxed) != nullptr) {
+        block = pool.remote_lists[cls].exchange(nullptr, std::memory_order_acquire);
+        settle(pool);
+    }
+    if(block != nullptr) {
+        pool.free_lists[cls] = block->next;
+        return block;
+    }
+
+    size_t bytes = (cls + 1) * GRANULARITY;
+    if(pool.cursor == nullptr || pool.cursor + bytes > pool.limit) {
+        pool.cursor = static_cast<char*>(::operator new(CHUNK_SIZE, std::align_val_t(CHUNK_SIZE)));
+        pool.limit = pool.cursor + CHUNK_SIZE;
+        reinterpret_cast<Header*>(pool.cursor)->owner = &pool;
+        pool.cursor += sizeof(Header);
+        stats.chunks++;
+    }
+
+    void* ptr = pool.cursor;
+    pool.cursor += bytes;
+    return ptr;
+}
+
+void pfix_deallocate(void* ptr, size_t size) {
+    if(ptr == nullptr) return;
+
+    auto& pool = local_pool();
+    size_t cls = size_class(size);
+    auto owner = cls >= NUM_CLASSES ? (static_cast<Header*>(ptr) - 1)->owner : chunk_owner(ptr);
+
+    if(owner != &pool) {
+        if(cls >= NUM_CLASSES) {
+            ::operator delete(static_cast<Header*>(ptr) - 1);
+            owner->remote_bytes.fetch_add(size, std::memory_order_relaxed);
+            owner->remote_objects.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            free_remote(*owner, static_cast<FreeBlock*>(ptr), cls, size);
+        }
+        return;
+    }
+
+    auto& stats = pool.stats;
+    stats.deallocations++;
+    stats.live_objects--;
+    stats.live_bytes -= size;
+
+    if(cls >= NUM_CLASSES) {
+        ::operator delete(static_cast<Header*>(ptr) - 1);
+        return;
+    }
+
+    auto block = static_cast<FreeBlock*>(ptr);
+    block->next = pool.free_lists[cls];
+    pool.free_lists[cls] = block;
+}
+
+const PfixAllocStats& pfix_alloc_stats() {
+    auto& pool = local_pool();
+    settle(pool);
+    return pool.stats;
+}
+
+std::ostream& operator<<(std::ostream& os, const PfixAllocStats& stats) {
+    os << "allocations: " << stats.allocations
+       << " deallocations: " << stats.deallocations
+       << " live: " << stats.live_objects << " (" << stats.live_bytes << " bytes)"
+       << " peak: " << stats.peak_bytes << " bytes"
+       << " chunks: " << stats.chunks
+       << " large: " << stats.large;
+    return os;
+}
@@ -0,0 +1,29 @@
+#ifndef __PFIX_ALLOCATOR_HPP__
+#define __PFIX_ALLOCATOR_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+struct PfixAllocStats {
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+    uint64_t live_objects = 0;
+    uint64_t live_bytes = 0;
+    uint64_t peak_bytes = 0;
+    uint64_t chunks = 0;    // chunks carved into size classes
+    uint64_t large = 0;     // allocations too big for any size class
+};
+
+// Allocation of interpreter objects.
+// Small objects are served from per size class free lists, which are
+// refilled by bump allocation from large chunks. Pools are per thread, an
+// object freed on another thread goes back to the pool that allocated it
+// and is counted in the statistics of that thread.
+void* pfix_allocate(size_t size);
+void pfix_deallocate(void* ptr, size_t size);
+
+const PfixAllocStats& pfix_alloc_stats();
+std::ostream& operator<<(std::ostream& os, const PfixAllocStats& stats);
+
+#endif
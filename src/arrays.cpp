@@ -0,0 +1,485 @@
+#include "arrays.hpp"
+#include "interpreter.hpp"
+#include "parallel.hpp"
+#include "bigint.hpp"
+
+bool is_packed(const Value& x) {
+    return x.tag == TypeTag::INT_ARR || x.tag == TypeTag::FLT_ARR;
+}
+
+void ArrayBuilder::push(Value x) {
+    if(kind == TypeTag::OBJ) {
+        kind = x.tag == TypeTag::INT || x.tag == TypeTag::FLT ? x.tag : TypeTag::ARR;
+        if(kind == TypeTag::INT) ints.reserve(capacity);
+        if(kind == TypeTag::FLT) flts.reserve(capacity);
+    } else if(kind != TypeTag::ARR && x.tag != kind) {
+        unpack();
+    }
+
+    switch(kind) {
+        case TypeTag::INT: ints.push_back(x.i); break;
+        case TypeTag::FLT: flts.push_back(x.f); break;
+        default: values.push_back(std::move(x));
+    }
+}
+
+void ArrayBuilder::unpack() {
+    for(auto x : ints) values.emplace_back(x);
+    for(auto x : flts) values.emplace_back(x);
+    ints = {};
+    flts = {};
+    kind = TypeTag::ARR;
+}
+
+Value ArrayBuilder::finish() {
+    switch(kind) {
+        case TypeTag::INT: return std::make_unique<IntArr>(std::move(ints));
+        case TypeTag::FLT: return std::make_unique<FltArr>(std::move(flts));
+        default: return std::make_unique<Arr>(std::move(values));
+    }
+}
+
+Value make_array(std::deque<Value>&& elements) {
+    ArrayBuilder builder(elements.size());
+    for(auto& x : elements) builder.push(std::move(x));
+    return builder.finish();
+}
+
+namespace {
+
+double to_double(const Value& x) {
+    return x.tag == TypeTag::FLT ? x.f : integer_to_double(x);
+}
+
+// Elements of a numeric array or a number, borrowed from packed storage or
+// converted. A number has size 1 and is_scalar set.
+class Numbers {
+public:
+    bool is_int = true;
+    bool is_scalar = false;
+
+    // Set if some :Int is a big integer, ints is left empty then
+    bool is_big = false;
+
+    const int64_t* ints = nullptr;
+    const double* flts = nullptr;
+    size_t size = 0;
+
+    explicit Numbers(const Value& x) : source(x) {
+        switch(x.tag) {
+            case TypeTag::INT:
+                is_scalar = true;
+                ints = &x.i;
+                size = 1;
+                break;
+            case TypeTag::BIG_INT:
+                is_scalar = true;
+                is_big = true;
+                size = 1;
+                break;
+            case TypeTag::FLT:
+                is_int = false;
+                is_scalar = true;
+                flts = &x.f;
+                size = 1;
+                break;
+            case TypeTag::INT_ARR:
+                ints = x.as<IntArr>()->vec.data();
+                size = x.as<IntArr>()->vec.size();
+                break;
+            case TypeTag::FLT_ARR:
+                is_int = false;
+                flts = x.as<FltArr>()->vec.data();
+                size = x.as<FltArr>()->vec.size();
+                break;
+            case TypeTag::ARR:
+                convert(x.as<Arr>()->vec);
+                break;
+            default:
+                throw std::runtime_error("Expected a numeric array, found " + type_to_string(x.tag));
+        }
+    }
+
+    // Elements as :Flt, converting :Int
+    const double* doubles() {
+        if(!is_int) return flts;
+        if(converted.size() != size) {
+            converted.resize(size);
+            for(size_t i = 0; i < size; i++) converted[i] = is_big ? to_double(at(i)) : ints[i];
+        }
+        return converted.data();
+    }
+
+    Value at(size_t i) const {
+        if(is_scalar) return source;
+        switch(source.tag) {
+            case TypeTag::INT_ARR: return Value(ints[i]);
+            case TypeTag::FLT_ARR: return Value(flts[i]);
+            default: return source.as<Arr>()->vec[i];
+        }
+    }
+
+private:
+    const Value& source;
+    std::vector<int64_t> int_storage;
+    std::vector<double> converted;
+
+    void convert(const std::deque<Value>& vec) {
+        size = vec.size();
+        for(auto& x : vec) {
+            if(x.tag == TypeTag::FLT) is_int = false;
+            else if(x.tag == TypeTag::BIG_INT) is_big = true;
+            else if(x.tag != TypeTag::INT) throw std::runtime_error("Expected a numeric array, found " + type_to_string(x.tag) + " element");
+        }
+        if(!is_int) {
+            is_big = false;
+            for(auto& x : vec) converted.push_back(to_double(x));
+            flts = converted.data();
+        } else if(!is_big) {
+            for(auto& x : vec) int_storage.push_back(x.i);
+            ints = int_storage.data();
+        }
+    }
+};
+
+bool is_numeric_operand(const Value& x) {
+    return is_packed(x) || x.tag == TypeTag::ARR || is_integer(x) || x.tag == TypeTag::FLT;
+}
+
+Value integer_arith(ArrOp op, const Value& x, const Value& y) {
+    switch(op) {
+        case ArrOp::ADD: return integer_add(x, y);
+        case ArrOp::SUB: return integer_sub(x, y);
+        case ArrOp::MUL: return integer_mul(x, y);
+        default: throw std::logic_error("Invalid array operation");
+    }
+}
+
+// :Int elements from the first that overflowed on, the ones before are in result
+Value promoted_arith(ArrOp op, const Numbers& x, const Numbers& y, size_t n, const int64_t* result, size_t done) {
+    ArrayBuilder builder(n);
+    for(size_t i = 0; i < done; i++) builder.push(Value(result[i]));
+    for(size_t i = done; i < n; i++) builder.push(integer_arith(op, x.at(i), y.at(i)));
+    return builder.finish();
+}
+
+// The result is written into lhs if it is a packed array of the result
+// type that no other value refers to
+Value arith(ArrOp op, Value& lhs, const Value& rhs) {
+    if(!is_numeric_operand(lhs) || !is_numeric_operand(rhs)) {
+        throw std::runtime_error("Invalid binary arithmetic operation");
+    }
+
+    Numbers x(lhs);
+    Numbers y(rhs);
+    if(!x.is_scalar && !y.is_scalar && x.size != y.size) {
+        throw std::runtime_error("Arrays of different length " + std::to_string(x.size) + " and " + std::to_string(y.size));
+    }
+
+    auto& kernels = array_kernels();
+    size_t n = x.is_scalar ? y.size : x.size;
+
+    if(x.is_int && y.is_int && op != ArrOp::DIV) {
+        if(x.is_big || y.is_big) return promoted_arith(op, x, y, n, nullptr, 0);
+
+        // Overflowing elements are not written, so lhs still holds them
+        bool in_place = lhs.tag == TypeTag::INT_ARR && !lhs.is_shared();
+        std::vector<int64_t> out(in_place ? 0 : n);
+        int64_t* result = in_place ? lhs.as<IntArr>()->vec.data() : out.data();
+        size_t done;
+        if(x.is_scalar) done = kernels.int_op_scalar(op, y.ints, x.ints[0], result, n, true);
+        else if(y.is_scalar) done = kernels.int_op_scalar(op, x.ints, y.ints[0], result, n, false);
+        else done = kernels.int_op(op, x.ints, y.ints, result, n);
+        if(done < n) return promoted_arith(op, x, y, n, result, done);
+        if(in_place) return std::move(lhs);
+        return std::make_unique<IntArr>(std::move(out));
+    }
+
+    bool in_place = lhs.tag == TypeTag::FLT_ARR && !lhs.is_shared();
+    std::vector<double> out(in_place ? 0 : n);
+    double* result = in_place ? lhs.as<FltArr>()->vec.data() : out.data();
+    if(x.is_scalar) kernels.flt_op_scalar(op, y.doubles(), x.doubles()[0], result, n, true);
+    else if(y.is_scalar) kernels.flt_op_scalar(op, x.doubles(), y.doubles()[0], result, n, false);
+    else kernels.flt_op(op, x.doubles(), y.doubles(), result, n);
+    if(in_place) return std::move(lhs);
+    return std::make_unique<FltArr>(std::move(out));
+}
+
+size_t length(const Value& x) {
+    switch(x.tag) {
+        case TypeTag::ARR: return x.as<Arr>()->vec.size();
+        case TypeTag::INT_ARR: return x.as<IntArr>()->vec.size();
+        case TypeTag::FLT_ARR: return x.as<FltArr>()->vec.size();
+        default: throw std::runtime_error("Expected an array, found " + type_to_string(x.tag));
+    }
+}
+
+// Element i of an array, moved out of it if take is set and no other
+// value refers to the array
+Value element(Value& x, size_t i, bool take) {
+    switch(x.tag) {
+        case TypeTag::INT_ARR: return Value(x.as<IntArr>()->vec[i]);
+        case TypeTag::FLT_ARR: return Value(x.as<FltArr>()->vec[i]);
+        default:
+            if(take && !x.is_shared()) return std::move(x.as<Arr>()->vec[i]);
+            return x.as<Arr>()->vec[i];
+    }
+}
+
+// Pops a function and the array below it
+ExeArr* pop_function(PfixStack& stack, Value& function, Value& arr, const char* word) {
+    if(stack.size() < 2) throw std::runtime_error(std::string(word) + " expects an array and a function");
+    stack.expect(TypeTag::EXE_ARR);
+    function = stack.pop();
+    arr = stack.pop();
+    length(arr);
+    return function.as<ExeArr>();
+}
+
+// Element i of an array of the parent, copied for a worker
+Value worker_element(PfixWorker& worker, Value& x, size_t i) {
+    return x.tag == TypeTag::ARR ? worker.copy(x.as<Arr>()->vec[i]) : element(x, i, false);
+}
+
+Numbers pop_array(PfixStack* s, Value& holder) {
+    if(s->empty()) throw std::runtime_error("Expected an array");
+    holder = s->pop();
+    Numbers x(holder);
+    if(x.is_scalar) throw std::runtime_error("Expected a numeric array, found " + type_to_string(holder.tag));
+    return x;
+}
+
+}
+
+bool packed_arith(PfixStack* s, ArrOp op) {
+    if(s->size() < 2 || (!is_packed(s->back()) && !is_packed((*s)[s->size() - 2]))) return false;
+
+    auto rhs = s->pop();
+    auto& lhs = s->back();
+    lhs = arith(op, lhs, rhs);
+    return true;
+}
+
+// Reductions of :Int arrays fall back to big integers if the kernel overflows
+void array_sum(PfixStack* s) {
+    Value holder;
+    auto x = pop_array(s, holder);
+    auto& kernels = array_kernels();
+    if(!x.is_int) {
+        s->emplace_back(kernels.flt_sum(x.flts, x.size));
+        return;
+    }
+
+    int64_t sum;
+    if(!x.is_big && kernels.int_sum(x.ints, x.size, sum)) {
+        s->emplace_back(sum);
+        return;
+    }
+    Value acc(0);
+    for(size_t i = 0; i < x.size; i++) acc = integer_add(acc, x.at(i));
+    s->push_back(std::move(acc));
+}
+
+namespace {
+
+void array_extreme(PfixStack* s, bool is_max) {
+    Value holder;
+    auto x = pop_array(s, holder);
+    if(x.size == 0) throw std::runtime_error(is_max ? "Maximum of an empty array" : "Minimum of an empty array");
+
+    auto& kernels = array_kernels();
+    if(!x.is_int) {
+        s->emplace_back(is_max ? kernels.flt_max(x.flts, x.size) : kernels.flt_min(x.flts, x.size));
+    } else if(!x.is_big) {
+        s->emplace_back(is_max ? kernels.int_max(x.ints, x.size) : kernels.int_min(x.ints, x.size));
+    } else {
+        auto result = x.at(0);
+        for(size_t i = 1; i < x.size; i++) {
+            auto y = x.at(i);
+            int c = integer_compare(y, result);
+            if(is_max ? c > 0 : c < 0) result = std::move(y);
+        }
+        s->push_back(std::move(result));
+    }
+}
+
+}
+
+void array_min(PfixStack* s) {
+    array_extreme(s, false);
+}
+
+void array_max(PfixStack* s) {
+    array_extreme(s, true);
+}
+
+void array_dot(PfixStack* s) {
+    Value y_holder, x_holder;
+    auto y = pop_array(s, y_holder);
+    auto x = pop_array(s, x_holder);
+    if(x.size != y.size) {
+        throw std::runtime_error("Arrays of different length " + std::to_string(x.size) + " and " + std::to_string(y.size));
+    }
+
+    auto& kernels = array_kernels();
+    if(!x.is_int || !y.is_int) {
+        s->emplace_back(kernels.flt_dot(x.doubles(), y.doubles(), x.size));
+        return;
+    }
+
+    int64_t dot;
+    if(!x.is_big && !y.is_big && kernels.int_dot(x.ints, y.ints, x.size, dot)) {
+        s->emplace_back(dot);
+        return;
+    }
+    Value acc(0);
+    for(size_t i = 0; i < x.size; i++) acc = integer_add(acc, integer_mul(x.at(i), y.at(i)));
+    s->push_back(std::move(acc));
+}
+
+void array_map(PfixInterpreter* interp) {
+    auto& stack = interp->stack;
+    Value function, arr;
+    auto exe_arr = pop_function(stack, function, arr, "map");
+
+    size_t n = length(arr);
+    ArrayBuilder builder(n);
+    for(size_t i = 0; i < n; i++) {
+        size_t base = stack.size();
+        stack.push_back(element(arr, i, true));
+        interp->call(exe_arr);
+        if(stack.size() != base + 1) throw std::runtime_error("map expects the function to leave one value");
+        builder.push(stack.pop());
+    }
+    stack.push_back(builder.finish());
+}
+
+void array_filter(PfixInterpreter* interp) {
+    auto& stack = interp->stack;
+    Value function, arr;
+    auto exe_arr = pop_function(stack, function, arr, "filter");
+
+    size_t n = length(arr);
+    ArrayBuilder builder(n);
+    for(size_t i = 0; i < n; i++) {
+        size_t base = stack.size();
+        stack.push_back(element(arr, i, false));
+        interp->call(exe_arr);
+        if(stack.size() != base + 1 || stack.back().tag != TypeTag::BOOL) {
+            throw std::runtime_error("filter expects the function to leave a :Bool");
+        }
+        if(stack.pop().b) builder.push(element(arr, i, true));
+    }
+    stack.push_back(builder.finish());
+}
+
+// arr init f reduce, f gets the accumulator and the element
+void array_reduce(PfixInterpreter* interp) {
+    auto& stack = interp->stack;
+    if(stack.size() < 3) throw std::runtime_error("reduce expects an array, an initial value and a function");
+    stack.expect(TypeTag::EXE_ARR);
+    auto function = stack.pop();
+    auto acc = stack.pop();
+    auto arr = stack.pop();
+    auto exe_arr = function.as<ExeArr>();
+
+    size_t n = length(arr);
+    for(size_t i = 0; i < n; i++) {
+        size_t base = stack.size();
+        stack.push_back(std::move(acc));
+        stack.push_back(element(arr, i, true));
+        interp->call(exe_arr);
+        if(stack.size() != base + 1) throw std::runtime_error("reduce expects the function to leave one value");
+        acc = stack.pop();
+    }
+    stack.push_back(std::move(acc));
+}
+
+void array_each(PfixInterpreter* interp) {
+    auto& stack = interp->stack;
+    Value function, arr;
+    auto exe_arr = pop_function(stack, function, arr, "each");
+
+    size_t n = length(arr);
+    for(size_t i = 0; i < n; i++) {
+        stack.push_back(element(arr, i, true));
+        interp->call(exe_arr);
+    }
+}
+
+void array_pmap(PfixInterpreter* interp) {
+    auto& stack = interp->stack;
+    Value function, arr;
+    pop_function(stack, function, arr, "pmap");
+
+    size_t n = length(arr);
+    std::vector<Value> results(n);
+    run_chunks(*interp, n, [&](PfixWorker& worker, size_t chunk, size_t begin, size_t end) {
+        auto& worker_stack = worker.interp.stack;
+        auto f = worker.copy(function);
+        for(size_t i = begin; i < end; i++) {
+            worker_stack.push_back(worker_element(worker, arr, i));
+            worker.interp.call(f.as<ExeArr>());
+            if(worker_stack.size() != 1) throw std::runtime_error("pmap expects the function to leave one value");
+            auto x = worker_stack.pop();
+            expect_transferable(x, "pmap");
+            results[i] = std::move(x);
+        }
+    });
+
+    ArrayBuilder builder(n);
+    for(auto& x : results) builder.push(std::move(x));
+    stack.push_back(builder.finish());
+}
+
+void array_preduce(PfixInterpreter* interp) {
+    auto& stack = interp->stack;
+    if(stack.size() < 3) throw std::runtime_error("preduce expects an array, an initial value and a function");
+    stack.expect(TypeTag::EXE_ARR);
+    auto function = stack.pop();
+    auto init = stack.pop();
+    auto arr = stack.pop();
+
+    size_t n = length(arr);
+    std::vector<Value> partial(num_chunks(n));
+    run_chunks(*interp, n, [&](PfixWorker& worker, size_t chunk, size_t begin, size_t end) {
+        auto& worker_stack = worker.interp.stack;
+        auto f = worker.copy(function);
+        auto acc = chunk == 0 ? worker.copy(init) : worker_element(worker, arr, begin++);
+        for(size_t i = begin; i < end; i++) {
+            worker_stack.push_back(std::move(acc));
+            worker_stack.push_back(worker_element(worker, arr, i));
+            worker.interp.call(f.as<ExeArr>());
+            if(worker_stack.size() != 1) throw std::runtime_error("preduce expects the function to leave one value");
+            acc = worker_stack.pop();
+        }
+        expect_transferable(acc, "preduce");
+        partial[chunk] = std::move(acc);
+    });
+
+    // Chunks are combined in order on this thread
+    if(partial.empty()) {
+        stack.push_back(std::move(init));
+        return;
+    }
+    auto acc = std::move(partial[0]);
+    for(size_t i = 1; i < partial.size(); i++) {
+        size_t base = stack.size();
+        stack.push_back(std::move(acc));
+        stack.push_back(std::move(partial[i]));
+        interp->call(function.as<ExeArr>());
+        if(stack.size() != base + 1) throw std::runtime_error("preduce expects the function to leave one value");
+        acc = stack.pop();
+    }
+    stack.push_back(std::move(acc));
+}
+
+void array_range(PfixStack* s) {
+    if(s->size() < 2) throw std::runtime_error("range expects a start and an end");
+    int64_t end = s->popInt();
+    int64_t start = s->popInt();
+
+    ArrayBuilder builder(end > start ? size_t(uint64_t(end) - uint64_t(start)) : 0);
+    for(int64_t i = start; i < end; i++) builder.push(Value(i));
+    s->push_back(builder.finish());
+}
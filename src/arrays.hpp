@@ -0,0 +1,63 @@
+#ifndef __PFIX_ARRAYS_HPP__
+#define __PFIX_ARRAYS_HPP__
+
+#include "types.hpp"
+#include "simd.hpp"
+
+class PfixInterpreter;
+
+bool is_packed(const Value& x);
+
+// Collects the elements of a new array, packed for as long as they all
+// are :Int or all are :Flt
+class ArrayBuilder {
+public:
+    explicit ArrayBuilder(size_t capacity = 0) : capacity(capacity) {}
+
+    void push(Value x);
+    Value finish();
+
+private:
+    size_t capacity;
+
+    // INT or FLT while packed, ARR once mixed, OBJ while empty
+    TypeTag kind = TypeTag::OBJ;
+    std::vector<int64_t> ints;
+    std::vector<double> flts;
+    std::deque<Value> values;
+
+    void unpack();
+};
+
+// Array of the elements, packed if they are all :Int or all :Flt
+Value make_array(std::deque<Value>&& elements);
+
+// Element-wise arithmetic if one of the two top values is a packed array,
+// the other one may be an array of the same length or a number.
+// Returns false if neither is packed, the scalar builtin applies then.
+bool packed_arith(PfixStack* s, ArrOp op);
+
+// Reductions of a numeric array
+void array_sum(PfixStack* s);
+void array_min(PfixStack* s);
+void array_max(PfixStack* s);
+void array_dot(PfixStack* s);
+
+// Higher-order builtins, the function runs once per element without
+// copying the array
+void array_map(PfixInterpreter* interp);
+void array_filter(PfixInterpreter* interp);
+void array_reduce(PfixInterpreter* interp);
+void array_each(PfixInterpreter* interp);
+
+// map and reduce on the thread pool, see parallel.hpp. Chunks of the array
+// run in workers with copies of the function and its scope, the results
+// keep the order of the elements. preduce expects an associative function,
+// init only starts the first chunk.
+void array_pmap(PfixInterpreter* interp);
+void array_preduce(PfixInterpreter* interp);
+
+// start end range  =>  [start, ..., end - 1]
+void array_range(PfixStack* s);
+
+#endif
@@ -0,0 +1,360 @@
+#include "bigint.hpp"
+
+#include <algorithm>
+
+namespace {
+
+using Limbs = std::vector<uint32_t>;
+
+void trim(Limbs& x) {
+    while(!x.empty() && x.back() == 0) x.pop_back();
+}
+
+int compare_magnitude(const Limbs& x, const Limbs& y) {
+    if(x.size() != y.size()) return x.size() < y.size() ? -1 : 1;
+    for(size_t i = x.size(); i-- > 0;) {
+        if(x[i] != y[i]) return x[i] < y[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+Limbs add_magnitude(const Limbs& x, const Limbs& y) {
+    auto& a = x.size() >= y.size() ? x : y;
+    auto& b = x.size() >= y.size() ? y : x;
+    Limbs r(a.size() + 1);
+    uint64_t carry = 0;
+    for(size_t i = 0; i < a.size(); i++) {
+        carry += uint64_t(a[i]) + (i < b.size() ? b[i] : 0);
+        r[i] = uint32_t(carry);
+        carry >>= 32;
+    }
+    r[a.size()] = uint32_t(carry);
+    trim(r);
+    return r;
+}
+
+// x - y, x is at least y
+Limbs sub_magnitude(const Limbs& x, const Limbs& y) {
+    Limbs r(x.size());
+    int64_t borrow = 0;
+    for(size_t i = 0; i < x.size(); i++) {
+        int64_t d = int64_t(x[i]) - (i < y.size() ? y[i] : 0) - borrow;
+        r[i] = uint32_t(d);
+        borrow = d < 0;
+    }
+    trim(r);
+    return r;
+}
+
+// r += x << 32 * shift
+void add_shifted(Limbs& r, const Limbs& x, size_t shift) {
+    if(r.size() < shift + x.size() + 1) r.resize(shift + x.size() + 1);
+    uint64_t carry = 0;
+    size_t i = 0;
+    for(; i < x.size(); i++) {
+        carry += uint64_t(r[shift + i]) + x[i];
+        r[shift + i] = uint32_t(carry);
+        carry >>= 32;
+    }
+    for(; carry != 0; i++) {
+        if(shift + i == r.size()) r.push_back(0);
+        carry += r[shift + i];
+        r[shift + i] = uint32_t(carry);
+        carry >>= 32;
+    }
+}
+
+Limbs view(const uint32_t* x, size_t n) {
+    Limbs r(x, x + n);
+    trim(r);
+    return r;
+}
+
+Limbs mul_magnitude(const uint32_t* x, size_t n, const uint32_t* y, size_t m);
+
+Limbs mul_magnitude(const Limbs& x, const Limbs& y) {
+    return mul_magnitude(x.data(), x.size(), y.data(), y.size());
+}
+
+// Schoolbook below KARATSUBA_LIMBS. Above it x = x1 B + x0 and y = y1 B + y0
+// take the three products x0 y0, x1 y1 and (x0 + x1)(y0 + y1) instead of four.
+Limbs mul_magnitude(const uint32_t* x, size_t n, const uint32_t* y, size_t m) {
+    if(n < m) {
+        std::swap(x, y);
+        std::swap(n, m);
+    }
+    if(m == 0) return {};
+
+    Limbs r;
+    if(m < KARATSUBA_LIMBS) {
+        r.assign(n + m, 0);
+        for(size_t i = 0; i < m; i++) {
+            uint64_t carry = 0;
+            for(size_t j = 0; j < n; j++) {
+                carry += uint64_t(y[i]) * x[j] + r[i + j];
+                r[i + j] = uint32_t(carry);
+                carry >>= 32;
+            }
+            r[i + n] = uint32_t(carry);
+        }
+        trim(r);
+        return r;
+    }
+
+    size_t half = (n + 1) / 2;
+    if(m <= half) {
+        // y is too short to split, x is multiplied by it in two halves
+        r = mul_magnitude(x, half, y, m);
+        add_shifted(r, mul_magnitude(x + half, n - half, y, m), half);
+        trim(r);
+        return r;
+    }
+
+    auto x0 = view(x, half);
+    auto x1 = view(x + half, n - half);
+    auto y0 = view(y, half);
+    auto y1 = view(y + half, m - half);
+    auto z0 = mul_magnitude(x0, y0);
+    auto z2 = mul_magnitude(x1, y1);
+    auto z1 = mul_magnitude(add_magnitude(x0, x1), add_magnitude(y0, y1));
+    z1 = sub_magnitude(sub_magnitude(z1, z0), z2);
+
+    r = std::move(z0);
+    add_shifted(r, z1, half);
+    add_shifted(r, z2, 2 * half);
+    trim(r);
+    return r;
+}
+
+// Quotient and remainder of u / v by Knuth's algorithm D, v is not zero
+void divmod_magnitude(const Limbs& u, const Limbs& v, Limbs& q, Limbs& r) {
+    if(compare_magnitude(u, v) < 0) {
+        q.clear();
+        r = u;
+        return;
+    }
+
+    size_t n = v.size();
+    size_t m = u.size();
+    if(n == 1) {
+        q.assign(m, 0);
+        uint64_t rem = 0;
+        for(size_t i = m; i-- > 0;) {
+            uint64_t cur = rem << 32 | u[i];
+            q[i] = uint32_t(cur / v[0]);
+            rem = cur % v[0];
+        }
+        trim(q);
+        r.clear();
+        if(rem != 0) r.push_back(uint32_t(rem));
+        return;
+    }
+
+    // Shift both so that the top limb of the divisor has its high bit set,
+    // then every estimate of a quotient limb is at most two too large
+    int s = __builtin_clz(v[n - 1]);
+    Limbs vn(n);
+    Limbs un(m + 1);
+    for(size_t i = n - 1; i > 0; i--) vn[i] = v[i] << s | uint32_t(uint64_t(v[i - 1]) >> (32 - s));
+    vn[0] = v[0] << s;
+    un[m] = uint32_t(uint64_t(u[m - 1]) >> (32 - s));
+    for(size_t i = m - 1; i > 0; i--) un[i] = u[i] << s | uint32_t(uint64_t(u[i - 1]) >> (32 - s));
+    un[0] = u[0] << s;
+
+    const uint64_t base = uint64_t(1) << 32;
+    q.assign(m - n + 1, 0);
+    for(size_t j = m - n + 1; j-- > 0;) {
+        uint64_t num = uint64_t(un[j + n]) << 32 | un[j + n - 1];
+        uint64_t qhat = num / vn[n - 1];
+        uint64_t rhat = num % vn[n - 1];
+        while(qhat >= base || qhat * vn[n - 2] > (rhat << 32 | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if(rhat >= base) break;
+        }
+
+        // un -= qhat * vn, added back once if qhat was one too large
+        int64_t k = 0;
+        int64_t t;
+        for(size_t i = 0; i < n; i++) {
+            uint64_t p = qhat * vn[i];
+            t = int64_t(un[i + j]) - k - int64_t(p & 0xFFFFFFFF);
+            un[i + j] = uint32_t(t);
+            k = int64_t(p >> 32) - (t >> 32);
+        }
+        t = int64_t(un[j + n]) - k;
+        un[j + n] = uint32_t(t);
+
+        q[j] = uint32_t(qhat);
+        if(t < 0) {
+            q[j]--;
+            uint64_t carry = 0;
+            for(size_t i = 0; i < n; i++) {
+                carry += uint64_t(un[i + j]) + vn[i];
+                un[i + j] = uint32_t(carry);
+                carry >>= 32;
+            }
+            un[j + n] += uint32_t(carry);
+        }
+    }
+    trim(q);
+
+    r.resize(n);
+    for(size_t i = 0; i < n; i++) r[i] = un[i] >> s | uint32_t(uint64_t(un[i + 1]) << (32 - s));
+    trim(r);
+}
+
+// Sign and magnitude of an :Int of any size
+class Operand {
+public:
+    bool negative;
+    const Limbs* limbs;
+
+    explicit Operand(const Value& x) {
+        if(x.tag == TypeTag::BIG_INT) {
+            negative = x.as<BigInt>()->negative;
+            limbs = &x.as<BigInt>()->limbs;
+            return;
+        }
+        negative = x.i < 0;
+        uint64_t magnitude = negative ? 0 - uint64_t(x.i) : uint64_t(x.i);
+        if(magnitude != 0) small.push_back(uint32_t(magnitude));
+        if(magnitude >> 32 != 0) small.push_back(uint32_t(magnitude >> 32));
+        limbs = &small;
+    }
+
+    Operand(const Operand&) = delete;
+
+private:
+    Limbs small;
+};
+
+// Unboxed if it fits into 64 bits
+Value make_integer(bool negative, Limbs&& limbs) {
+    trim(limbs);
+    if(limbs.size() <= 2) {
+        uint64_t magnitude = limbs.empty() ? 0 : limbs[0];
+        if(limbs.size() == 2) magnitude |= uint64_t(limbs[1]) << 32;
+        if(!negative && magnitude <= uint64_t(INT64_MAX)) return Value(int64_t(magnitude));
+        if(negative && magnitude <= uint64_t(INT64_MAX) + 1) return Value(int64_t(0 - magnitude));
+    }
+
+    auto big = std::make_unique<BigInt>();
+    big->negative = negative;
+    big->limbs = std::move(limbs);
+    return Value(std::move(big));
+}
+
+Value add_signed(const Operand& x, bool y_negative, const Limbs& y) {
+    if(x.negative == y_negative) return make_integer(x.negative, add_magnitude(*x.limbs, y));
+    if(compare_magnitude(*x.limbs, y) >= 0) return make_integer(x.negative, sub_magnitude(*x.limbs, y));
+    return make_integer(y_negative, sub_magnitude(y, *x.limbs));
+}
+
+}
+
+std::string BigInt::to_string() const {
+    // Nine decimal digits at a time, least significant first
+    Limbs x = limbs;
+    std::vector<uint32_t> chunks;
+    while(!x.empty()) {
+        uint64_t rem = 0;
+        for(size_t i = x.size(); i-- > 0;) {
+            uint64_t cur = rem << 32 | x[i];
+            x[i] = uint32_t(cur / 1000000000);
+            rem = cur % 1000000000;
+        }
+        trim(x);
+        chunks.push_back(uint32_t(rem));
+    }
+    if(chunks.empty()) return "0";
+
+    std::string str = negative ? "-" : "";
+    str += std::to_string(chunks.back());
+    for(size_t i = chunks.size() - 1; i-- > 0;) {
+        auto digits = std::to_string(chunks[i]);
+        str.append(9 - digits.size(), '0');
+        str += digits;
+    }
+    return str;
+}
+
+double BigInt::to_double() const {
+    double x = 0;
+    for(size_t i = limbs.size(); i-- > 0;) x = x * 4294967296.0 + limbs[i];
+    return negative ? -x : x;
+}
+
+Value parse_big_integer(std::string_view text) {
+    bool negative = !text.empty() && text[0] == '-';
+    if(negative) text.remove_prefix(1);
+
+    Limbs limbs;
+    while(!text.empty()) {
+        size_t n = std::min<size_t>(9, text.size());
+        uint64_t carry = 0;
+        uint64_t scale = 1;
+        for(size_t i = 0; i < n; i++) {
+            carry = carry * 10 + (text[i] - '0');
+            scale *= 10;
+        }
+        text.remove_prefix(n);
+
+        for(auto& limb : limbs) {
+            carry += limb * scale;
+            limb = uint32_t(carry);
+            carry >>= 32;
+        }
+        if(carry != 0) limbs.push_back(uint32_t(carry));
+    }
+    return make_integer(negative, std::move(limbs));
+}
+
+Value integer_add(const Value& x, const Value& y) {
+    Operand a(x);
+    Operand b(y);
+    return add_signed(a, b.negative, *b.limbs);
+}
+
+Value integer_sub(const Value& x, const Value& y) {
+    Operand a(x);
+    Operand b(y);
+    return add_signed(a, !b.negative, *b.limbs);
+}
+
+Value integer_mul(const Value& x, const Value& y) {
+    Operand a(x);
+    Operand b(y);
+    return make_integer(a.negative != b.negative, mul_magnitude(*a.limbs, *b.limbs));
+}
+
+Value integer_div(const Value& x, const Value& y) {
+    Operand a(x);
+    Operand b(y);
+    if(b.limbs->empty()) throw std::runtime_error("Division by zero");
+    Limbs q, r;
+    divmod_magnitude(*a.limbs, *b.limbs, q, r);
+    return make_integer(a.negative != b.negative, std::move(q));
+}
+
+Value integer_mod(const Value& x, const Value& y) {
+    Operand a(x);
+    Operand b(y);
+    if(b.limbs->empty()) throw std::runtime_error("Division by zero");
+    Limbs q, r;
+    divmod_magnitude(*a.limbs, *b.limbs, q, r);
+    return make_integer(a.negative, std::move(r));
+}
+
+int integer_compare(const Value& x, const Value& y) {
+    if(x.tag == TypeTag::INT && y.tag == TypeTag::INT) return (x.i > y.i) - (x.i < y.i);
+    Operand a(x);
+    Operand b(y);
+    if(a.negative != b.negative) return a.negative ? -1 : 1;
+    int c = compare_magnitude(*a.limbs, *b.limbs);
+    return a.negative ? -c : c;
+}
+
+double integer_to_double(const Value& x) {
+    return x.tag == TypeTag::INT ? double(x.i) : x.as<BigInt>()->to_double();
+}
@@ -0,0 +1,60 @@
+#ifndef __PFIX_BIGINT_HPP__
+#define __PFIX_BIGINT_HPP__
+
+#include "types.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Products of operands with at least this many limbs use Karatsuba
+constexpr size_t KARATSUBA_LIMBS = 32;
+
+// Integer beyond the 64 bits of an unboxed :Int.
+// Sign and magnitude, the limbs are stored least significant first without
+// leading zeros. Arithmetic on :Int promotes to it on overflow, and results
+// that fit into 64 bits again are unboxed, so a BigInt is never in range.
+class BigInt : public Obj {
+public:
+    bool negative = false;
+    std::vector<uint32_t> limbs;
+
+    BigInt() : Obj(TypeTag::BIG_INT) {}
+
+    std::string to_string() const;
+    double to_double() const;
+
+    virtual std::ostream& print(std::ostream& os) override {
+        os << to_string();
+        return os;
+    }
+
+    virtual std::unique_ptr<Obj> copy() override {
+        auto copy = std::make_unique<BigInt>();
+        copy->negative = negative;
+        copy->limbs = limbs;
+        return copy;
+    }
+};
+
+inline bool is_integer(const Value& x) {
+    return x.tag == TypeTag::INT || x.tag == TypeTag::BIG_INT;
+}
+
+// Literal of digits with an optional minus sign that does not fit into 64 bits
+Value parse_big_integer(std::string_view text);
+
+// Exact arithmetic on :Int operands of any size. Division truncates towards
+// zero and the remainder has the sign of the dividend, like on 64 bits.
+Value integer_add(const Value& x, const Value& y);
+Value integer_sub(const Value& x, const Value& y);
+Value integer_mul(const Value& x, const Value& y);
+Value integer_div(const Value& x, const Value& y);
+Value integer_mod(const Value& x, const Value& y);
+
+// Negative, zero or positive as x is less than, equal to or greater than y
+int integer_compare(const Value& x, const Value& y);
+
+double integer_to_double(const Value& x);
+
+#endif
@@ -0,0 +1,196 @@
+#include "collector.hpp"
+
+#include <chrono>
+#include <unordered_map>
+
+namespace {
+
+// Scope or array an edge of the graph leads to, with its reference count
+struct Target {
+    PfixScope* scope;
+    Obj* obj;
+    long refs;
+};
+
+struct Node {
+    PfixScope* scope;
+    Obj* obj;
+
+    // References from outside the graph, once the edges are subtracted
+    long refs;
+    bool live;
+};
+
+// Edges are the references a scope or array holds itself, every one of
+// them is counted by its target
+template<typename F>
+void for_each_edge(const Node& node, F f) {
+    auto value = [&f](const Value& x) {
+        if((x.tag == TypeTag::ARR || x.tag == TypeTag::EXE_ARR) && x.obj != nullptr) {
+            f(Target{nullptr, x.obj, x.obj->refs});
+        }
+    };
+    auto scope = [&f](const PfixEnvironment& env) {
+        if(env) f(Target{env.get(), nullptr, env.use_count()});
+    };
+
+    if(node.scope != nullptr) {
+        scope(node.scope->parent);
+        node.scope->bindings.for_each([&value](SymbolId, const Value& x) { value(x); });
+        return;
+    }
+    if(node.obj->tag == TypeTag::EXE_ARR) scope(static_cast<ExeArr*>(node.obj)->env);
+    for(auto& x : static_cast<Arr*>(node.obj)->vec) value(x);
+}
+
+// Scopes and arrays reachable from the candidates. Old scopes are left out
+// of young collections, their references count as coming from outside.
+class Graph {
+public:
+    explicit Graph(bool full) : full(full) {}
+
+    void add(const Target& target) { find(target, true); }
+
+    // Subtract the references within the graph
+    void count() {
+        while(!work.empty()) {
+            auto node = work.back();
+            work.pop_back();
+            for_each_edge(*node, [this](const Target& target) {
+                auto node = find(target, true);
+                if(node != nullptr) node->refs--;
+            });
+        }
+    }
+
+    // Whatever is referred to from outside is alive, and so is all it reaches
+    void mark() {
+        for(auto& it : nodes) {
+            if(it.second.refs > 0 && !it.second.live) {
+                it.second.live = true;
+                work.push_back(&it.second);
+            }
+        }
+        while(!work.empty()) {
+            auto node = work.back();
+            work.pop_back();
+            for_each_edge(*node, [this](const Target& target) {
+                auto node = find(target, false);
+                if(node != nullptr && !node->live) {
+                    node->live = true;
+                    work.push_back(node);
+                }
+            });
+        }
+    }
+
+    // Clear the bindings of dead scopes. Their arrays are held meanwhile, so
+    // that no dead scope is freed before its bindings are cleared.
+    // Returns the number of dead scopes.
+    size_t sweep() {
+        std::vector<PfixScope*> scopes;
+        std::vector<Obj*> objs;
+        for(auto& it : nodes) {
+            if(it.second.live) continue;
+            if(it.second.scope != nullptr) {
+                scopes.push_back(it.second.scope);
+            } else {
+                it.second.obj->refs++;
+                objs.push_back(it.second.obj);
+            }
+        }
+
+        for(auto scope : scopes) scope->bindings = PfixDictionary(scope->parent != nullptr);
+        for(auto obj : objs) {
+            if(--obj->refs == 0) delete obj;
+        }
+        return scopes.size();
+    }
+
+    bool is_live(const PfixScope* scope) const {
+        auto iter = nodes.find(scope);
+        return iter == nodes.end() || iter->second.live;
+    }
+
+private:
+    bool full;
+    std::unordered_map<const void*, Node> nodes;
+    std::vector<Node*> work;
+
+    Node* find(const Target& target, bool insert) {
+        if(target.scope != nullptr && !full && target.scope->generation == PfixScope::Generation::OLD) return nullptr;
+
+        const void* key = target.scope != nullptr ? static_cast<const void*>(target.scope) : target.obj;
+        if(!insert) {
+            auto iter = nodes.find(key);
+            return iter != nodes.end() ? &iter->second : nullptr;
+        }
+
+        auto inserted = nodes.try_emplace(key, Node{target.scope, target.obj, target.refs, false});
+        if(inserted.second) work.push_back(&inserted.first->second);
+        return &inserted.first->second;
+    }
+};
+
+}
+
+PfixCollector& PfixCollector::local() {
+    static thread_local PfixCollector collector;
+    return collector;
+}
+
+void PfixCollector::track(const PfixEnvironment& scope) {
+    if(!scope || scope->generation != PfixScope::Generation::UNTRACKED) return;
+    scope->generation = PfixScope::Generation::YOUNG;
+    young.push_back(scope);
+    if(young.size() >= YOUNG_SCOPES) collect(old.size() >= next_full);
+}
+
+void PfixCollector::collect(bool full) {
+    auto start = std::chrono::steady_clock::now();
+
+    // Held until the end, so that dead candidates are freed last
+    std::vector<PfixEnvironment> candidates;
+    auto lock = [&candidates](std::vector<std::weak_ptr<PfixScope>>& scopes) {
+        for(auto& it : scopes) {
+            auto scope = it.lock();
+            if(scope) candidates.push_back(std::move(scope));
+        }
+        scopes.clear();
+    };
+    lock(young);
+    if(full) lock(old);
+
+    Graph graph(full);
+    for(auto& scope : candidates) graph.add({scope.get(), nullptr, scope.use_count() - 1});
+    graph.count();
+    graph.mark();
+    collector_stats.freed_scopes += graph.sweep();
+
+    for(auto& scope : candidates) {
+        if(!graph.is_live(scope.get())) continue;
+        scope->generation = PfixScope::Generation::OLD;
+        old.push_back(scope);
+    }
+    if(full) {
+        next_full = std::max(YOUNG_SCOPES, 2 * old.size());
+        collector_stats.full_collections++;
+    }
+    candidates.clear();
+
+    uint64_t pause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    collector_stats.collections++;
+    collector_stats.last_pause_ns = pause;
+    collector_stats.max_pause_ns = std::max(collector_stats.max_pause_ns, pause);
+    collector_stats.total_pause_ns += pause;
+}
+
+std::ostream& operator<<(std::ostream& os, const PfixCollectorStats& stats) {
+    os << "collections: " << stats.collections << " (" << stats.full_collections << " full)"
+       << " freed: " << stats.freed_scopes << " scopes"
+       << " pause: last " << stats.last_pause_ns / 1000 << " us"
+       << " max " << stats.max_pause_ns / 1000 << " us"
+       << " total " << stats.total_pause_ns / 1000 << " us";
+    return os;
+}
@@ -0,0 +1,59 @@
+#ifndef __PFIX_COLLECTOR_HPP__
+#define __PFIX_COLLECTOR_HPP__
+
+#include "types.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// Scopes captured by closures tracked before the young ones are collected
+constexpr size_t YOUNG_SCOPES = 1024;
+
+struct PfixCollectorStats {
+    uint64_t collections = 0;
+    uint64_t full_collections = 0;
+    uint64_t freed_scopes = 0;
+    uint64_t last_pause_ns = 0;
+    uint64_t max_pause_ns = 0;
+    uint64_t total_pause_ns = 0;
+};
+
+// Cycle collector for closure scopes.
+// A function stored in the scope it captured keeps that scope alive, and
+// reference counts never free the pair. Every scope captured by lam or fun
+// is tracked, and all cycles go through one of them. A collection counts
+// the references between the scopes and arrays reachable from the tracked
+// scopes, anything referred to from elsewhere is alive, as is everything
+// it reaches. The bindings of the other scopes are cleared.
+//
+// Scopes that survive a collection become old. Collections run every
+// YOUNG_SCOPES captured scopes and stop at old scopes, so that pauses are
+// bounded by the young ones. Once the old scopes have doubled since the
+// last full collection, the next one covers all of them.
+//
+// Collectors are per thread, like the values they look at.
+class PfixCollector {
+public:
+    // Collector of the calling thread
+    static PfixCollector& local();
+
+    // Track a scope captured by a closure
+    void track(const PfixEnvironment& scope);
+
+    void collect(bool full);
+
+    size_t tracked() const { return young.size() + old.size(); }
+    const PfixCollectorStats& stats() const { return collector_stats; }
+
+private:
+    std::vector<std::weak_ptr<PfixScope>> young;
+    std::vector<std::weak_ptr<PfixScope>> old;
+    size_t next_full = YOUNG_SCOPES;
+    PfixCollectorStats collector_stats;
+};
+
+std::ostream& operator<<(std::ostream& os, const PfixCollectorStats& stats);
+
+#endif
@@ -0,0 +1,696 @@
+#include "compiler.hpp"
+#include "interpreter.hpp"
+
+using Body = std::deque<Value>;
+
+uint32_t Code::add_constant(Value obj) {
+    constants.push_back(std::move(obj));
+    return constants.size() - 1;
+}
+
+void Code::emit(OpCode op, uint32_t arg) {
+    instructions.push_back({op, arg});
+    caches.emplace_back();
+}
+
+const std::string* symbol_at(const Body& body, size_t i) {
+    if(i >= body.size() || body[i].tag != TypeTag::SYM) return nullptr;
+    return &body[i].as<Sym>()->str();
+}
+
+bool is_symbol_at(const Body& body, size_t i, const std::string& str) {
+    auto sym = symbol_at(body, i);
+    return sym != nullptr && *sym == str;
+}
+
+// Returns the index past the '}' that closes the '{' at index i
+size_t match_block(const Body& body, size_t i) {
+    int depth = 0;
+    for(; i < body.size(); i++) {
+        if(is_symbol_at(body, i, "{")) {
+            depth++;
+        } else if(is_symbol_at(body, i, "}")) {
+            if(--depth == 0) return i + 1;
+        }
+    }
+    throw std::runtime_error("Executable array without closing '}'");
+}
+
+const SymbolId SYM_STORE = intern("!");
+const SymbolId SYM_FUN = intern("fun");
+const SymbolId SYM_ADD = intern("+");
+const SymbolId SYM_SUB = intern("-");
+const SymbolId SYM_LESS = intern("<");
+const SymbolId SYM_GREATER = intern(">");
+const SymbolId SYM_LESS_EQUAL = intern("<=");
+const SymbolId SYM_GREATER_EQUAL = intern(">=");
+const SymbolId SYM_AND = intern("and");
+
+// Words that are fused with a constant operand
+const std::pair<SymbolId, OpCode> FUSED_WORDS[] = {
+    {SYM_ADD, OpCode::ADD_CONST},
+    {SYM_SUB, OpCode::SUB_CONST},
+    {SYM_LESS, OpCode::LESS_CONST},
+    {SYM_GREATER, OpCode::GREATER_CONST},
+    {SYM_LESS_EQUAL, OpCode::LESS_EQUAL_CONST},
+    {SYM_GREATER_EQUAL, OpCode::GREATER_EQUAL_CONST},
+};
+
+SymbolId fused_word(OpCode op) {
+    for(auto& it : FUSED_WORDS) {
+        if(it.second == op) return it.first;
+    }
+    throw std::logic_error("Not a superinstruction");
+}
+
+bool Code::assumptions_hold() const {
+    for(auto id : assumptions) {
+        if(PfixDictionary::version(id) > definitions) return false;
+    }
+    return true;
+}
+
+bool Code::inlining_holds() const {
+    for(auto id : inlined) {
+        if(PfixDictionary::version(id) > definitions) return false;
+    }
+    return true;
+}
+
+std::shared_ptr<Code> Code::deoptimized() {
+    if(!fallback) {
+        fallback = std::make_shared<Code>();
+        fallback->instructions = baseline;
+        fallback->caches.resize(baseline.size());
+        fallback->constants = constants;
+        fallback->num_locals = num_locals;
+        fallback->needs_scope = needs_scope;
+        fallback->definitions = PfixDictionary::definitions;
+        fallback->inlined = inlined;
+    }
+    return fallback;
+}
+
+class Compiler {
+private:
+    PfixScope& scope;
+
+    // Parameters resolved to frame slots
+    std::vector<SymbolId> locals;
+
+    // Jumps to the end of each loop being compiled in place
+    std::vector<std::vector<size_t>> breaks;
+
+    int local_slot(SymbolId id) {
+        auto it = std::find(locals.begin(), locals.end(), id);
+        return it == locals.end() ? -1 : it - locals.begin();
+    }
+
+    // Whether body[begin .. end) refers to a local by name or stores into it
+    bool mentions_local(const Body& body, size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            auto sym = symbol_at(body, i);
+            if(sym == nullptr) continue;
+            if(local_slot(body[i].as<Sym>()->id) >= 0) return true;
+            if(sym->size() > 1 && sym->back() == '!' && local_slot(intern(sym->substr(0, sym->size()-1))) >= 0) return true;
+        }
+        return false;
+    }
+
+    bool is_native(const std::string& sym) {
+        auto binding = scope.lookup(intern(sym));
+        return binding != nullptr && binding->tag == TypeTag::NATIVE_SYM;
+    }
+
+    // Whether the body binds sym itself, as sym! or sym: ... The frame that
+    // stores it would go on running the builtin compiled in place.
+    bool rebinds(const Body& body, const std::string& sym) {
+        for(size_t i = 0; i < body.size(); i++) {
+            auto str = symbol_at(body, i);
+            if(str == nullptr || str->size() != sym.size() + 1 || str->compare(0, sym.size(), sym) != 0) continue;
+            if(str->back() == '!' || str->back() == ':') return true;
+        }
+        return false;
+    }
+
+    bool is_fixed_builtin(const Body& body, const std::string& sym) {
+        return is_native(sym) && !rebinds(body, sym);
+    }
+
+    // The code is compiled again once a word it relies on being the builtin is redefined
+    void depend(Code& code, const std::string& sym) {
+        auto id = intern(sym);
+        if(std::find(code.inlined.begin(), code.inlined.end(), id) == code.inlined.end()) {
+            code.inlined.push_back(id);
+            PfixDictionary::watch(id);
+        }
+    }
+
+    // Compile the block body[begin+1 .. end-1) into its own executable array
+    std::unique_ptr<ExeArr> block(const Body& body, size_t begin, size_t end) {
+        std::vector<Value> vec(body.begin() + begin + 1, body.begin() + end - 1);
+
+        auto exe_arr = std::make_unique<ExeArr>(std::move(vec));
+        exe_arr->code = compile(exe_arr->vec, scope);
+        return exe_arr;
+    }
+
+    // Blocks followed by if or a loop word are compiled in place
+    struct Inlined {
+        size_t blocks = 0;      // 0 if the block is not inlined
+        size_t ends[2];         // index past the first and the second block
+        std::string word;
+        const std::vector<std::string>* builtins = nullptr;
+    };
+
+    Inlined inlined(const Body& body, size_t i) {
+        // Loops over one block, with the builtins their counters use
+        static const std::vector<std::pair<std::string, std::vector<std::string>>> one = {
+            {"if", {}}, {"loop", {}}, {"times", {">", "-"}}, {"for", {"<", "+"}},
+            {"for-step", {">", "<", "+", "and"}}
+        };
+        static const std::vector<std::pair<std::string, std::vector<std::string>>> two = {
+            {"if", {}}, {"while", {}}
+        };
+
+        Inlined form;
+        form.ends[0] = match_block(body, i);
+        form.ends[1] = is_symbol_at(body, form.ends[0], "{") ? match_block(body, form.ends[0]) : form.ends[0];
+
+        auto find = [this, &body, &form](size_t blocks, const auto& words) {
+            for(auto& it : words) {
+                if(!is_symbol_at(body, form.ends[blocks - 1], it.first) || !is_fixed_builtin(body, it.first)) continue;
+                if(!std::all_of(it.second.begin(), it.second.end(), [this, &body](auto& word) { return is_fixed_builtin(body, word); })) continue;
+                form.blocks = blocks;
+                form.word = it.first;
+                form.builtins = &it.second;
+                return true;
+            }
+            return false;
+        };
+        if(!find(1, one) && form.ends[1] != form.ends[0]) find(2, two);
+        return form;
+    }
+
+    // Blocks that are not inlined may outlive the frame, so a function
+    // only gets frame slots if none of them refers to a parameter
+    bool has_escaping_local(const Body& body, size_t begin, size_t end) {
+        size_t i = begin;
+        while(i < end) {
+            if(!is_symbol_at(body, i, "{")) {
+                i++;
+                continue;
+            }
+
+            auto form = inlined(body, i);
+            if(form.blocks == 0) {
+                if(mentions_local(body, i + 1, form.ends[0] - 1)) return true;
+                i = form.ends[0];
+                continue;
+            }
+            if(has_escaping_local(body, i + 1, form.ends[0] - 1)) return true;
+            if(form.blocks == 2 && has_escaping_local(body, form.ends[0] + 1, form.ends[1] - 1)) return true;
+            i = form.ends[form.blocks - 1] + 1;
+        }
+        return false;
+    }
+
+    // Inline the branch body[begin+1 .. end-1) into the current code
+    void inline_block(Code& code, const Body& body, size_t begin, size_t end) {
+        emit_range(code, body, begin + 1, end - 1);
+    }
+
+    // Parse a parameter list once, at compile time
+    size_t params(Code& code, const Body& body, size_t i) {
+        size_t end = i + 1;
+        while(end < body.size() && !is_symbol_at(body, end, ")")) end++;
+        if(end >= body.size()) {
+            code.emit(OpCode::PUSH_CONST, code.add_constant(body[i]));
+            return i + 1;
+        }
+
+        PfixStack tmp;
+        tmp.insert(tmp.end(), body.begin() + i, body.begin() + end);
+        param_list_close(&tmp);
+        code.emit(OpCode::PUSH_CONST, code.add_constant(tmp.pop()));
+        return end + 1;
+    }
+
+    // cond {then} {else} if  =>  JUMP_IF_FALSE else; then; JUMP end; else: else; end:
+    // cond {then} if         =>  JUMP_IF_FALSE end; then; end:
+    void branches(Code& code, const Body& body, size_t i, const Inlined& form) {
+        size_t jump_else = code.instructions.size();
+        code.emit(OpCode::JUMP_IF_FALSE);
+        inline_block(code, body, i, form.ends[0]);
+        if(form.blocks == 2) {
+            size_t jump_end = code.instructions.size();
+            code.emit(OpCode::JUMP);
+            code.instructions[jump_else].arg = code.instructions.size();
+            inline_block(code, body, form.ends[0], form.ends[1]);
+            code.instructions[jump_end].arg = code.instructions.size();
+        } else {
+            code.instructions[jump_else].arg = code.instructions.size();
+        }
+    }
+
+    // {body} loop              =>  start: body; JUMP start; end:
+    // {cond} {body} while      =>  start: cond; JUMP_IF_FALSE end; body; JUMP start; end:
+    // n {body} times           =>  count = n; start: count > 0; JUMP_IF_FALSE end; count -= 1; body; JUMP start; end:
+    // first last {body} for    =>  index = first; start: index < last; JUMP_IF_FALSE end; index; index += 1; body; JUMP start; end:
+    // for-step counts down while index > last if the step is negative, a step of 0 runs no iteration
+    // The counters live in frame slots past the parameters, break jumps to the end.
+    void loop(Code& code, const Body& body, size_t i, const Inlined& form) {
+        breaks.emplace_back();
+        size_t start = code.instructions.size();
+
+        auto exit_unless = [&code, this](SymbolId compare) {
+            code.emit(OpCode::CALL, compare);
+            breaks.back().push_back(code.instructions.size());
+            code.emit(OpCode::JUMP_IF_FALSE);
+        };
+
+        if(form.word == "while") {
+            inline_block(code, body, i, form.ends[0]);
+            breaks.back().push_back(code.instructions.size());
+            code.emit(OpCode::JUMP_IF_FALSE);
+        } else if(form.word == "times") {
+            uint32_t count = code.num_locals++;
+            code.emit(OpCode::STORE_LOCAL, count);
+            start = code.instructions.size();
+            code.emit(OpCode::LOAD_LOCAL, count);
+            code.emit(OpCode::PUSH_CONST, code.add_constant(Value(0)));
+            exit_unless(SYM_GREATER);
+            code.emit(OpCode::LOAD_LOCAL, count);
+            code.emit(OpCode::PUSH_CONST, code.add_constant(Value(1)));
+            code.emit(OpCode::CALL, SYM_SUB);
+            code.emit(OpCode::STORE_LOCAL, count);
+        } else if(form.word == "for") {
+            uint32_t last = code.num_locals++;
+            uint32_t index = code.num_locals++;
+            code.emit(OpCode::STORE_LOCAL, last);
+            code.emit(OpCode::STORE_LOCAL, index);
+            start = code.instructions.size();
+            code.emit(OpCode::LOAD_LOCAL, index);
+            code.emit(OpCode::LOAD_LOCAL, last);
+            exit_unless(SYM_LESS);
+            code.emit(OpCode::LOAD_LOCAL, index);
+            code.emit(OpCode::LOAD_LOCAL, index);
+            code.emit(OpCode::PUSH_CONST, code.add_constant(Value(1)));
+            code.emit(OpCode::CALL, SYM_ADD);
+            code.emit(OpCode::STORE_LOCAL, index);
+        } else if(form.word == "for-step") {
+            uint32_t step = code.num_locals++;
+            uint32_t last = code.num_locals++;
+            uint32_t index = code.num_locals++;
+            code.emit(OpCode::STORE_LOCAL, step);
+            code.emit(OpCode::STORE_LOCAL, last);
+            code.emit(OpCode::STORE_LOCAL, index);
+            start = code.instructions.size();
+            code.emit(OpCode::LOAD_LOCAL, step);
+            code.emit(OpCode::PUSH_CONST, code.add_constant(Value(0)));
+            code.emit(OpCode::CALL, SYM_GREATER);
+            size_t down = code.instructions.size();
+            code.emit(OpCode::JUMP_IF_FALSE);
+            code.emit(OpCode::LOAD_LOCAL, index);
+            code.emit(OpCode::LOAD_LOCAL, last);
+            code.emit(OpCode::CALL, SYM_LESS);
+            size_t test = code.instructions.size();
+            code.emit(OpCode::JUMP);
+            code.instructions[down].arg = code.instructions.size();
+            code.emit(OpCode::LOAD_LOCAL, index);
+            code.emit(OpCode::LOAD_LOCAL, last);
+            code.emit(OpCode::CALL, SYM_GREATER);
+            code.emit(OpCode::LOAD_LOCAL, step);
+            code.emit(OpCode::PUSH_CONST, code.add_constant(Value(0)));
+            code.emit(OpCode::CALL, SYM_LESS);
+            code.emit(OpCode::CALL, SYM_AND);
+            code.instructions[test].arg = code.instructions.size();
+            breaks.back().push_back(code.instructions.size());
+            code.emit(OpCode::JUMP_IF_FALSE);
+            code.emit(OpCode::LOAD_LOCAL, index);
+            code.emit(OpCode::LOAD_LOCAL, index);
+            code.emit(OpCode::LOAD_LOCAL, step);
+            code.emit(OpCode::CALL, SYM_ADD);
+            code.emit(OpCode::STORE_LOCAL, index);
+        }
+
+        inline_block(code, body, form.blocks == 2 ? form.ends[0] : i, form.ends[form.blocks - 1]);
+        code.emit(OpCode::JUMP, start);
+        for(auto at : breaks.back()) code.instructions[at].arg = code.instructions.size();
+        breaks.pop_back();
+    }
+
+    size_t braces(Code& code, const Body& body, size_t i) {
+        auto form = inlined(body, i);
+        if(form.blocks == 0) {
+            auto exe_arr = block(body, i, form.ends[0]);
+            if(exe_arr->code->needs_scope) code.needs_scope = true;
+            code.emit(OpCode::PUSH_CONST, code.add_constant(std::move(exe_arr)));
+            return form.ends[0];
+        }
+
+        depend(code, form.word);
+        for(auto& word : *form.builtins) depend(code, word);
+        if(form.word == "if") branches(code, body, i, form);
+        else loop(code, body, i, form);
+        return form.ends[form.blocks - 1] + 1;
+    }
+
+public:
+    Compiler(PfixScope& scope) : scope(scope) {}
+
+    // Whether body starts with a loop over the given number of blocks
+    // that is compiled in place
+    bool is_inlined_loop(const Body& body, size_t blocks) {
+        auto form = inlined(body, 0);
+        return form.blocks == blocks && form.word != "if";
+    }
+
+    // Pop the arguments into their slots, the last parameter is on top.
+    // Falls back to storing them in the scope of the call.
+    void prologue(Code& code, const Body& body, const Params& params) {
+        for(auto& it : params.params) locals.push_back(intern(it.first));
+
+        bool slots = !has_escaping_local(body, 0, body.size());
+        for(size_t i = locals.size(); i-- > 0;) {
+            if(slots) {
+                code.emit(OpCode::STORE_LOCAL, i);
+            } else {
+                code.emit(OpCode::STORE, locals[i]);
+                code.needs_scope = true;
+            }
+        }
+
+        if(slots) code.num_locals = locals.size();
+        else locals.clear();
+    }
+
+    void emit_range(Code& code, const Body& body, size_t begin, size_t end) {
+        size_t i = begin;
+        while(i < end) {
+            auto sym = symbol_at(body, i);
+            if(sym == nullptr || is_literal_symbol(*sym)) {
+                code.emit(OpCode::PUSH_CONST, code.add_constant(body[i]));
+                i++;
+            } else if(*sym == "{") {
+                i = braces(code, body, i);
+            } else if(*sym == "(") {
+                i = params(code, body, i);
+            } else if(*sym == "break" && !breaks.empty() && is_fixed_builtin(body, "break")) {
+                depend(code, "break");
+                breaks.back().push_back(code.instructions.size());
+                code.emit(OpCode::JUMP);
+                i++;
+            } else if(sym->size() > 1 && sym->back() == '!') {
+                auto id = intern(sym->substr(0, sym->size()-1));
+                int slot = local_slot(id);
+                if(slot >= 0) {
+                    code.emit(OpCode::STORE_LOCAL, slot);
+                } else {
+                    code.emit(OpCode::STORE, id);
+                    code.needs_scope = true;
+                }
+                i++;
+            } else {
+                auto id = body[i].as<Sym>()->id;
+                int slot = local_slot(id);
+                if(slot >= 0) {
+                    code.emit(OpCode::LOAD_LOCAL, slot);
+                } else {
+                    code.emit(OpCode::CALL, id);
+                    if(id == SYM_STORE || id == SYM_FUN) code.needs_scope = true;
+                }
+                i++;
+            }
+        }
+    }
+};
+
+// Peephole optimizer. Every pass marks instructions as removed and then
+// compacts the body, remapping jump targets and keeping the index each
+// instruction had in the baseline.
+class Optimizer {
+private:
+    Code& code;
+    PfixScope& scope;
+    std::vector<Instruction>& ins;
+    std::vector<uint32_t> origin;
+    std::vector<bool> removed;
+    std::vector<bool> targets;
+
+    static bool is_jump(OpCode op) {
+        return op == OpCode::JUMP || op == OpCode::JUMP_IF_FALSE;
+    }
+
+    // Builtins that may be evaluated early, as long as no scope shadows them
+    bool is_pure(SymbolId id) {
+        auto binding = scope.lookup(id);
+        return binding != nullptr && binding->tag == TypeTag::NATIVE_SYM
+            && binding->as<NativeSym>()->pure && PfixDictionary::shadow_count(id) == 0;
+    }
+
+    void assume(SymbolId id) {
+        if(std::find(code.assumptions.begin(), code.assumptions.end(), id) == code.assumptions.end()) {
+            code.assumptions.push_back(id);
+            PfixDictionary::watch(id);
+        }
+    }
+
+    void find_targets() {
+        targets.assign(ins.size() + 1, false);
+        for(auto& it : ins) {
+            if(is_jump(it.op)) targets[it.arg] = true;
+        }
+    }
+
+    bool compact() {
+        std::vector<uint32_t> index(ins.size() + 1);
+        size_t n = 0;
+        for(size_t i = 0; i < ins.size(); i++) {
+            index[i] = n;
+            if(removed[i]) continue;
+            ins[n] = ins[i];
+            origin[n] = origin[i];
+            n++;
+        }
+        index[ins.size()] = n;
+
+        bool changed = n < ins.size();
+        ins.resize(n);
+        origin.resize(n);
+        for(auto& it : ins) {
+            if(is_jump(it.op)) it.arg = index[it.arg];
+        }
+        removed.assign(n, false);
+        return changed;
+    }
+
+    bool is_constant(size_t i) {
+        return !removed[i] && ins[i].op == OpCode::PUSH_CONST;
+    }
+
+    // c1 c2 op  =>  result
+    bool fold_call(size_t i) {
+        if(ins[i].op != OpCode::CALL || targets[i] || !is_pure(ins[i].arg)) return false;
+        auto native = scope.lookup(ins[i].arg)->as<NativeSym>();
+
+        for(size_t arity = 2; arity >= 1; arity--) {
+            if(i < arity) continue;
+            size_t begin = i - arity;
+
+            bool constant = true;
+            for(size_t j = begin; j < i; j++) {
+                if(!is_constant(j) || (j > begin && targets[j])) constant = false;
+            }
+            if(!constant) continue;
+
+            // Division by zero is left to run time
+            auto& last = code.constants[ins[i - 1].arg];
+            if((last.tag == TypeTag::INT && last.i == 0) || (last.tag == TypeTag::FLT && last.f == 0)) return false;
+
+            PfixStack tmp;
+            for(size_t j = begin; j < i; j++) tmp.push_back(code.constants[ins[j].arg]);
+            try {
+                native->call(&tmp);
+            } catch(const std::runtime_error&) {
+                continue;
+            }
+            if(tmp.size() != 1) continue;
+
+            ins[begin] = {OpCode::PUSH_CONST, code.add_constant(tmp.pop())};
+            for(size_t j = begin + 1; j <= i; j++) removed[j] = true;
+            assume(ins[i].arg);
+            return true;
+        }
+        return false;
+    }
+
+    // true JUMP_IF_FALSE l  =>
+    // false JUMP_IF_FALSE l  =>  JUMP l
+    bool fold_branch(size_t i) {
+        if(i + 1 >= ins.size() || !is_constant(i) || ins[i + 1].op != OpCode::JUMP_IF_FALSE || targets[i + 1]) {
+            return false;
+        }
+        auto& cond = code.constants[ins[i].arg];
+        if(cond.tag != TypeTag::BOOL) return false;
+
+        if(cond.b) removed[i] = true;
+        else ins[i] = {OpCode::JUMP, ins[i + 1].arg};
+        removed[i + 1] = true;
+        return true;
+    }
+
+    // Jumps to jumps go to the final target, jumps to the next instruction are dropped
+    bool thread_jump(size_t i) {
+        if(removed[i] || !is_jump(ins[i].op)) return false;
+
+        bool changed = false;
+        for(size_t n = 0; n < ins.size() && ins[i].arg < ins.size() && ins[ins[i].arg].op == OpCode::JUMP; n++) {
+            if(ins[ins[i].arg].arg == ins[i].arg) break;
+            ins[i].arg = ins[ins[i].arg].arg;
+            changed = true;
+        }
+
+        if(ins[i].op == OpCode::JUMP && ins[i].arg == i + 1) {
+            removed[i] = true;
+            changed = true;
+        }
+        return changed;
+    }
+
+    bool remove_unreachable() {
+        std::vector<bool> reachable(ins.size(), false);
+        std::vector<size_t> work = {0};
+        while(!work.empty()) {
+            size_t i = work.back();
+            work.pop_back();
+            if(i >= ins.size() || reachable[i]) continue;
+            reachable[i] = true;
+
+            if(ins[i].op != OpCode::JUMP) work.push_back(i + 1);
+            if(is_jump(ins[i].op)) work.push_back(ins[i].arg);
+        }
+
+        bool changed = false;
+        for(size_t i = 0; i < ins.size(); i++) {
+            if(!reachable[i]) {
+                removed[i] = true;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    // c op  =>  OP_CONST c
+    bool fuse(size_t i) {
+        if(i + 1 >= ins.size() || !is_constant(i) || ins[i + 1].op != OpCode::CALL || targets[i + 1]) {
+            return false;
+        }
+        auto& operand = code.constants[ins[i].arg];
+        if(operand.tag != TypeTag::INT && operand.tag != TypeTag::FLT) return false;
+
+        for(auto& it : FUSED_WORDS) {
+            if(it.first == ins[i + 1].arg && is_pure(it.first)) {
+                ins[i].op = it.second;
+                removed[i + 1] = true;
+                assume(it.first);
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    Optimizer(Code& code, PfixScope& scope) : code(code), scope(scope), ins(code.instructions) {}
+
+    void run() {
+        auto baseline = ins;
+        origin.resize(ins.size());
+        for(size_t i = 0; i < origin.size(); i++) origin[i] = i;
+        removed.assign(ins.size(), false);
+
+        bool optimized = false;
+        bool changed = true;
+        while(changed) {
+            changed = false;
+            find_targets();
+            for(size_t i = 0; i < ins.size(); i++) {
+                if(fold_call(i) || fold_branch(i) || thread_jump(i)) changed = true;
+            }
+            changed = compact() || changed;
+
+            if(remove_unreachable()) changed = true;
+            changed = compact() || changed;
+            optimized = optimized || changed;
+        }
+
+        find_targets();
+        for(size_t i = 0; i < ins.size(); i++) {
+            if(fuse(i)) optimized = true;
+        }
+        compact();
+
+        code.definitions = PfixDictionary::definitions;
+        if(!optimized) return;
+        code.caches.assign(ins.size(), InlineCache());
+
+        // Without assumptions the optimized code stays valid
+        if(code.assumptions.empty()) return;
+
+        // Frames are only suspended after a call, or not started yet
+        code.baseline_pc.resize(ins.size() + 1);
+        for(size_t i = 0; i < ins.size(); i++) {
+            code.baseline_pc[i] = origin[i];
+        }
+        code.baseline_pc[ins.size()] = baseline.size();
+        for(size_t i = 0; i < ins.size(); i++) {
+            if(ins[i].op == OpCode::CALL) code.baseline_pc[i + 1] = origin[i] + 1;
+        }
+        code.baseline_pc[0] = 0;
+        code.baseline = std::move(baseline);
+    }
+};
+
+void optimize(Code& code, PfixScope& scope) {
+    Optimizer(code, scope).run();
+}
+
+std::shared_ptr<Code> compile(const Body& body, PfixScope& scope, const Params* params) {
+    auto code = std::make_shared<Code>();
+    Compiler compiler(scope);
+    if(params != nullptr) {
+        compiler.prologue(*code, body, *params);
+        code->params = params->params;
+        code->ret_types = params->ret_types;
+    }
+    compiler.emit_range(*code, body, 0, body.size());
+    optimize(*code, scope);
+    return code;
+}
+
+std::shared_ptr<Code> recompile(const Code& code, const Body& body, PfixScope& scope) {
+    if(code.params.empty()) return compile(body, scope);
+
+    Params params(code.params, code.ret_types);
+    auto fresh = compile(body, scope, &params);
+    specialize(*fresh, params, code.self, scope);
+    return fresh;
+}
+
+std::shared_ptr<Code> compile_loop(const std::string& word, const std::vector<const ExeArr*>& blocks, PfixScope& scope) {
+    Body body;
+    for(auto block : blocks) {
+        body.push_back(std::make_unique<Sym>("{"));
+        body.insert(body.end(), block->vec.begin(), block->vec.end());
+        body.push_back(std::make_unique<Sym>("}"));
+    }
+    body.push_back(std::make_unique<Sym>(word));
+
+    Compiler compiler(scope);
+    if(!compiler.is_inlined_loop(body, blocks.size())) return nullptr;
+
+    auto code = std::make_shared<Code>();
+    compiler.emit_range(*code, body, 0, body.size());
+    optimize(*code, scope);
+    return code;
+}
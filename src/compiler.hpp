@@ -0,0 +1,151 @@
+#ifndef __PFIX_COMPILER_HPP__
+#define __PFIX_COMPILER_HPP__
+
+#include "types.hpp"
+#ifdef PFIX_JIT
+#include "jit.hpp"
+#endif
+
+#include <cstdint>
+
+enum class OpCode : uint8_t {
+    PUSH_CONST,     // push a copy of constants[arg]
+    CALL,           // look up the symbol id arg and call it (builtin or function)
+    STORE,          // pop the top of the stack into the symbol id arg
+    LOAD_LOCAL,     // push a copy of frame slot arg
+    STORE_LOCAL,    // pop the top of the stack into frame slot arg
+    JUMP,           // continue at instruction arg
+    JUMP_IF_FALSE,  // pop a :Bool, continue at instruction arg if it is false
+
+    // Superinstructions for a builtin applied to constants[arg] and the top
+    // of the stack, produced by the optimizer
+    ADD_CONST,
+    SUB_CONST,
+    LESS_CONST,
+    GREATER_CONST,
+    LESS_EQUAL_CONST,
+    GREATER_EQUAL_CONST,
+
+    // Arithmetic on operands known to have the same type, arg is a TypedOp.
+    // Only found in typed variants, no tags are checked.
+    INT_OP,
+    FLT_OP,
+    INT_CONST_OP,   // INT_OP with constants[arg >> 8] as right operand, arg & 0xff is the TypedOp
+};
+
+enum class TypedOp : uint8_t {
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    LESS,
+    GREATER,
+    LESS_EQUAL,
+    GREATER_EQUAL,
+    EQUAL,
+    NOT_EQUAL,
+};
+
+// Builtin word a superinstruction stands for
+SymbolId fused_word(OpCode op);
+
+// Whether the argument of op is a symbol id rather than an index
+inline bool has_symbol_arg(OpCode op) {
+    return op == OpCode::CALL || op == OpCode::STORE;
+}
+
+struct Instruction {
+    OpCode op;
+    uint32_t arg;
+};
+
+// Resolution of a call site, reused while the symbol is not shadowed
+// and the globals have not moved
+struct InlineCache {
+    PfixDictionary::Binding* binding = nullptr;
+    uint32_t epoch = 0;
+};
+
+// Compiled form of an executable array.
+// Built once when the array is closed and shared between all copies of it.
+class Code {
+public:
+    std::vector<Instruction> instructions;
+    std::vector<Value> constants;
+
+    // One per instruction, used by CALL
+    std::vector<InlineCache> caches;
+
+    // Number of frame slots used by parameters
+    uint32_t num_locals = 0;
+
+    // Whether a call needs its own scope for bindings created at run time
+    bool needs_scope = false;
+
+    // Set by the optimizer, folded and fused instructions assume that the
+    // words in assumptions are the builtins. Once one is redefined, frames
+    // continue in the baseline instructions at baseline_pc[pc].
+    std::vector<Instruction> baseline;
+    std::vector<uint32_t> baseline_pc;
+    std::vector<SymbolId> assumptions;
+
+    // PfixDictionary::definitions when the assumptions were last checked
+    uint32_t definitions = 0;
+
+    // Words compiled in place, such as if and the loops, and the builtins
+    // their counters use. Once one is redefined the array is compiled again.
+    std::vector<SymbolId> inlined;
+
+    // Parameter list the code was compiled with, to compile it again
+    Params::Parameters params;
+    Params::ReturnTypes ret_types;
+
+    // Variant for calls whose arguments have the types in guard, the last
+    // parameter is on top. Built by specialize for fully typed functions.
+    std::shared_ptr<Code> typed;
+    std::vector<TypeTag> guard;
+
+    // Set on a typed variant that is known to replace its arguments with
+    // values of these types, callers may rely on it
+    bool has_signature = false;
+    std::vector<TypeTag> returns;
+
+    // Function the code or its typed variant belongs to
+    SymbolId self = 0;
+
+#ifdef PFIX_JIT
+    // Calls of a typed variant, it is compiled once JIT_THRESHOLD is reached
+    uint32_t calls = 0;
+    std::shared_ptr<JitFunction> native;
+#endif
+
+    bool assumptions_hold() const;
+    bool inlining_holds() const;
+    std::shared_ptr<Code> deoptimized();
+
+    uint32_t add_constant(Value obj);
+    void emit(OpCode op, uint32_t arg = 0);
+
+private:
+    std::shared_ptr<Code> fallback;
+};
+
+std::shared_ptr<Code> compile(const std::deque<Value>& body, PfixScope& scope, const Params* params = nullptr);
+
+// Compile body again with the parameters code was compiled with, once
+// a word it compiled in place was redefined
+std::shared_ptr<Code> recompile(const Code& code, const std::deque<Value>& body, PfixScope& scope);
+
+// Compile the loop word over blocks that were pushed before it, as if they
+// had been written out. Returns null if it would not be compiled in place.
+std::shared_ptr<Code> compile_loop(const std::string& word, const std::vector<const ExeArr*>& blocks, PfixScope& scope);
+
+// Fold constants and dead branches and fuse common sequences
+void optimize(Code& code, PfixScope& scope);
+
+// Attach a typed variant to the code of function self if all of its
+// parameters have concrete types
+void specialize(Code& code, const Params& params, SymbolId self, PfixScope& scope);
+
+#endif
@@ -0,0 +1,195 @@
+#include "extension.hpp"
+
+#include <dlfcn.h>
+
+struct PfixCall {
+    Value result;
+    std::string error;
+    bool failed = false;
+};
+
+namespace {
+
+TypeTag to_tag(PfixType type) {
+    switch(type) {
+        case PFIX_INT: return TypeTag::INT;
+        case PFIX_FLT: return TypeTag::FLT;
+        case PFIX_BOOL: return TypeTag::BOOL;
+        case PFIX_STR: return TypeTag::STR;
+        case PFIX_INT_ARR: return TypeTag::INT_ARR;
+        case PFIX_FLT_ARR: return TypeTag::FLT_ARR;
+        default: return TypeTag::OBJ;
+    }
+}
+
+// Packed arrays print as :Arr, the element type matters here
+std::string describe(TypeTag tag) {
+    switch(tag) {
+        case TypeTag::INT_ARR: return ":Arr of :Int";
+        case TypeTag::FLT_ARR: return ":Arr of :Flt";
+        case TypeTag::BIG_INT: return ":Int beyond 64 bits";
+        default: return type_to_string(tag);
+    }
+}
+
+bool is_valid(PfixType type) {
+    return type >= PFIX_NONE && type <= PFIX_FLT_ARR;
+}
+
+// Empty arrays are not packed, they are passed as empty spans
+bool is_empty_arr(const Value& x) {
+    return x.tag == TypeTag::ARR && x.as<Arr>()->vec.empty();
+}
+
+bool borrow(const Value& x, PfixType type, PfixValue& arg) {
+    switch(type) {
+        case PFIX_INT:
+            if(x.tag != TypeTag::INT) return false;
+            arg.i = x.i;
+            return true;
+        case PFIX_FLT:
+            if(x.tag != TypeTag::FLT) return false;
+            arg.f = x.f;
+            return true;
+        case PFIX_BOOL:
+            if(x.tag != TypeTag::BOOL) return false;
+            arg.b = x.b;
+            return true;
+        case PFIX_STR: {
+            if(x.tag != TypeTag::STR) return false;
+            auto& str = x.as<Str>()->str;
+            arg.str.data = str.data();
+            arg.str.size = str.size();
+            return true;
+        }
+        case PFIX_INT_ARR:
+            if(is_empty_arr(x)) {
+                arg.int_arr.data = nullptr;
+                arg.int_arr.size = 0;
+                return true;
+            }
+            if(x.tag != TypeTag::INT_ARR) return false;
+            arg.int_arr.data = x.as<IntArr>()->vec.data();
+            arg.int_arr.size = x.as<IntArr>()->vec.size();
+            return true;
+        case PFIX_FLT_ARR:
+            if(is_empty_arr(x)) {
+                arg.flt_arr.data = nullptr;
+                arg.flt_arr.size = 0;
+                return true;
+            }
+            if(x.tag != TypeTag::FLT_ARR) return false;
+            arg.flt_arr.data = x.as<FltArr>()->vec.data();
+            arg.flt_arr.size = x.as<FltArr>()->vec.size();
+            return true;
+        default:
+            return false;
+    }
+}
+
+int define(PfixRegistry* registry, const PfixNativeDef* def) {
+    if(def == nullptr || def->name == nullptr || def->fn == nullptr || def->arity > PFIX_MAX_ARITY) return 0;
+    for(uint32_t i = 0; i < def->arity; i++) {
+        if(!is_valid(def->params[i]) || def->params[i] == PFIX_NONE) return 0;
+    }
+    if(!is_valid(def->result)) return 0;
+
+    auto& dictionary = *reinterpret_cast<PfixDictionary*>(registry);
+    std::string name(def->name);
+    if(dictionary.find(intern(name)) != nullptr) return 0;
+
+    auto native = std::make_shared<PfixExtensionNative>(PfixExtensionNative{name, *def});
+    dictionary[name] = std::make_unique<NativeSym>(std::move(native), (def->flags & PFIX_PURE) != 0);
+    return 1;
+}
+
+void result_str(PfixCall* call, const char* data, size_t size) {
+    call->result = Value(std::make_unique<Str>(std::string(data, size)));
+}
+
+int64_t* result_int_arr(PfixCall* call, size_t size) {
+    auto arr = std::make_unique<IntArr>(std::vector<int64_t>(size));
+    auto data = arr->vec.data();
+    call->result = Value(std::move(arr));
+    return data;
+}
+
+double* result_flt_arr(PfixCall* call, size_t size) {
+    auto arr = std::make_unique<FltArr>(std::vector<double>(size));
+    auto data = arr->vec.data();
+    call->result = Value(std::move(arr));
+    return data;
+}
+
+void error(PfixCall* call, const char* message) {
+    call->failed = true;
+    call->error = message != nullptr ? message : "failed";
+}
+
+const PfixHost host = {
+    PFIX_ABI_VERSION,
+    define,
+    result_str,
+    result_int_arr,
+    result_flt_arr,
+    error,
+};
+
+}
+
+void call_extension(PfixStack& stack, const PfixExtensionNative& native) {
+    auto& def = native.def;
+    if(stack.size() < def.arity) {
+        throw std::runtime_error(native.name + " expects " + std::to_string(def.arity) + " arguments");
+    }
+
+    size_t base = stack.size() - def.arity;
+    PfixValue args[PFIX_MAX_ARITY];
+    for(size_t i = 0; i < def.arity; i++) {
+        if(!borrow(stack[base + i], def.params[i], args[i])) {
+            throw std::runtime_error(native.name + " expects " + describe(to_tag(def.params[i]))
+                + " as argument " + std::to_string(i + 1) + ", found " + describe(stack[base + i].tag));
+        }
+    }
+
+    PfixCall call;
+    PfixValue result{};
+    def.fn(args, &result, &call);
+    if(call.failed) throw std::runtime_error(native.name + ": " + call.error);
+
+    // Failures leave the arguments on the stack, like those of the builtins
+    bool boxed = def.result == PFIX_STR || def.result == PFIX_INT_ARR || def.result == PFIX_FLT_ARR;
+    if(boxed && call.result.tag != to_tag(def.result)) {
+        throw std::runtime_error(native.name + " returned no " + describe(to_tag(def.result)));
+    }
+
+    stack.resize(base);
+    switch(def.result) {
+        case PFIX_NONE: break;
+        case PFIX_INT: stack.push_back(Value(result.i)); break;
+        case PFIX_FLT: stack.push_back(Value(result.f)); break;
+        case PFIX_BOOL: stack.push_back(Value(result.b != 0)); break;
+        default: stack.push_back(std::move(call.result)); break;
+    }
+}
+
+bool load_extension(void* handle, const std::string& name, PfixDictionary& dictionary) {
+    auto version = (PfixAbiVersionFn)dlsym(handle, ("PfixAbiVersion" + name).c_str());
+    auto entry = (PfixExtensionEntry)dlsym(handle, ("PfixExtension" + name).c_str());
+    if(version != nullptr && entry != nullptr) {
+        auto abi = version();
+        if(abi != PFIX_ABI_VERSION) {
+            throw std::runtime_error(name + " was built for extension ABI " + std::to_string(abi)
+                + ", expected " + std::to_string(PFIX_ABI_VERSION));
+        }
+        entry(&host, reinterpret_cast<PfixRegistry*>(&dictionary));
+        return true;
+    }
+
+    // Entry points from before the versioned interface expect the dictionary of that time
+    if(dlsym(handle, ("PfixInit" + name).c_str()) != nullptr) {
+        throw std::runtime_error(name + " was built for the unversioned extension interface, expected ABI "
+            + std::to_string(PFIX_ABI_VERSION));
+    }
+    return false;
+}
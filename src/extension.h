@@ -0,0 +1,111 @@
+#ifndef __PFIX_EXTENSION_H__
+#define __PFIX_EXTENSION_H__
+
+/*
+ * C interface for native extensions loaded with load-library.
+ * An extension declares the signature of each native up front. The
+ * interpreter checks the arguments against it before the call and passes
+ * them unboxed, strings and packed arrays borrow the data of the values
+ * on the stack. Extensions only include this header.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#define PFIX_EXPORT extern "C"
+#else
+#define PFIX_EXPORT
+#endif
+
+/* Extensions built against another version are rejected */
+#define PFIX_ABI_VERSION 2
+
+#define PFIX_MAX_ARITY 8
+
+typedef enum {
+    PFIX_NONE,      /* no result */
+    PFIX_INT,       /* :Int of at most 64 bits */
+    PFIX_FLT,
+    PFIX_BOOL,
+    PFIX_STR,
+    PFIX_INT_ARR,   /* array of only :Int */
+    PFIX_FLT_ARR    /* array of only :Flt */
+} PfixType;
+
+/*
+ * Argument or scalar result. Strings are not null terminated. Borrowed
+ * data stays valid until the native returns and must not be changed.
+ */
+typedef union {
+    int64_t i;
+    double f;
+    int b;
+    struct { const char* data; size_t size; } str;
+    struct { const int64_t* data; size_t size; } int_arr;
+    struct { const double* data; size_t size; } flt_arr;
+} PfixValue;
+
+typedef struct PfixCall PfixCall;
+typedef struct PfixRegistry PfixRegistry;
+
+/*
+ * args holds the arguments in the order they were pushed. Results of type
+ * PFIX_INT, PFIX_FLT and PFIX_BOOL are written to result, strings and
+ * arrays are created with the functions of the host.
+ */
+typedef void (*PfixNativeFn)(const PfixValue* args, PfixValue* result, PfixCall* call);
+
+/* The result only depends on the arguments, calls on constants are evaluated at compile time */
+#define PFIX_PURE 1
+
+typedef struct {
+    const char* name;
+    PfixNativeFn fn;
+    uint32_t arity;
+    PfixType params[PFIX_MAX_ARITY];
+    PfixType result;
+    uint32_t flags;
+} PfixNativeDef;
+
+/* Functions of the interpreter, valid while the entry point runs and during calls */
+typedef struct {
+    uint32_t abi_version;
+
+    /*
+     * Bind a native. Returns 0 without binding anything if the definition is
+     * invalid or the name is bound already, builtins cannot be replaced.
+     */
+    int (*define)(PfixRegistry* registry, const PfixNativeDef* def);
+
+    /* Results owned by the interpreter, the native fills in the arrays */
+    void (*result_str)(PfixCall* call, const char* data, size_t size);
+    int64_t* (*result_int_arr)(PfixCall* call, size_t size);
+    double* (*result_flt_arr)(PfixCall* call, size_t size);
+
+    /* Fail the call, the error is raised once the native returns */
+    void (*error)(PfixCall* call, const char* message);
+} PfixHost;
+
+/*
+ * An extension in name.so defines its entry point with
+ *
+ *     PFIX_EXTENSION(Name) {
+ *         host->define(registry, &def);
+ *     }
+ *
+ * where Name is the file name with its first letter in upper case.
+ */
+#define PFIX_EXTENSION(name) \
+    PFIX_EXPORT uint32_t PfixAbiVersion##name(void) { return PFIX_ABI_VERSION; } \
+    PFIX_EXPORT void PfixExtension##name(const PfixHost* host, PfixRegistry* registry)
+
+typedef uint32_t (*PfixAbiVersionFn)(void);
+typedef void (*PfixExtensionEntry)(const PfixHost* host, PfixRegistry* registry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
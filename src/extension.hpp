@@ -0,0 +1,24 @@
+#ifndef __PFIX_EXTENSION_HPP__
+#define __PFIX_EXTENSION_HPP__
+
+#include "types.hpp"
+#include "extension.h"
+
+#include <string>
+
+// Native registered through the C interface in extension.h
+struct PfixExtensionNative {
+    std::string name;
+    PfixNativeDef def;
+};
+
+// Pops the arguments of an extension native, checked against its
+// signature, and pushes its result
+void call_extension(PfixStack& stack, const PfixExtensionNative& native);
+
+// Runs the entry point of a library opened with dlopen, which must be built
+// against this version of extension.h. Returns false if the library has no
+// entry point for name.
+bool load_extension(void* handle, const std::string& name, PfixDictionary& dictionary);
+
+#endif
@@ -1,18 +1,30 @@
 #include "interpreter.hpp"
+#include "module.hpp"
+#include "arrays.hpp"
+#include "collector.hpp"
+#include "extension.hpp"
+#include "bigint.hpp"
 
-void param_list_close(PfixStack* s);
+#include <fstream>
 
-bool is_top_symbol(PfixStack* s, const std::string& str) {
-    return s->back()->tag == TypeTag::SYM && dynamic_cast<Sym*>(s->back().get())->str == str;
+// Symbols with a special meaning to the interpreter
+const SymbolId SYM_LBRACE = intern("{");
+const SymbolId SYM_RBRACE = intern("}");
+const SymbolId SYM_LBRACKET = intern("[");
+const SymbolId SYM_LPAREN = intern("(");
+const SymbolId SYM_RPAREN = intern(")");
+
+bool is_top_symbol(PfixStack* s, SymbolId id) {
+    return s->back().tag == TypeTag::SYM && s->back().as<Sym>()->id == id;
 }
 
 void arr_close(PfixStack* s) {
-    std::deque<std::unique_ptr<Obj>> arr;
-    while(s->size() > 0 && !is_top_symbol(s, "[")) arr.push_front(s->pop());
+    std::deque<Value> arr;
+    while(s->size() > 0 && !is_top_symbol(s, SYM_LBRACKET)) arr.push_front(s->pop());
 
-    if(s->size() > 0 && is_top_symbol(s, "[")) {
+    if(s->size() > 0 && is_top_symbol(s, SYM_LBRACKET)) {
         s->pop_back();
-        s->push_back(std::make_unique<Arr>(std::move(arr)));
+        s->push_back(make_array(std::move(arr)));
     } else {
         throw std::runtime_error("Expected an array beginning");
     }
@@ -23,12 +35,12 @@ void param_list_close(PfixStack* s) {
     std::vector<std::string> ret_types;
     std::vector<std::string> buffer;
 
-    while(s->size() > 0 && !is_top_symbol(s, "(")) {
+    while(s->size() > 0 && !is_top_symbol(s, SYM_LPAREN)) {
         s->expect(TypeTag::SYM);
-        buffer.push_back(dynamic_cast<Sym*>(s->pop().get())->str);
+        buffer.push_back(s->pop().as<Sym>()->str());
     }
 
-    if(s->size() > 0 && is_top_symbol(s, "(")) {
+    if(s->size() > 0 && is_top_symbol(s, SYM_LPAREN)) {
         s->pop_back();
 
         bool ret = false;
@@ -62,6 +74,7 @@ void param_list_close(PfixStack* s) {
     }
 }
 
+// Symbols that are pushed as they are instead of being evaluated
 void sanitize_symbol(std::string& sym) {
     if(sym[0] == ':') {
         sym.erase(0, 1);
@@ -71,6 +84,19 @@ void sanitize_symbol(std::string& sym) {
     }
 }
 
+// Id of the name a key such as x: binds, remembered per thread so that
+// stores in loops neither copy the name nor lock the symbol table
+SymbolId binding_id(SymbolId key) {
+    static thread_local std::vector<SymbolId> ids;
+    if(key >= ids.size()) ids.resize(key + 1, UINT32_MAX);
+    if(ids[key] == UINT32_MAX) {
+        auto name = symbol_name(key);
+        sanitize_symbol(name);
+        ids[key] = intern(name);
+    }
+    return ids[key];
+}
+
 void store_symbol(PfixInterpreter* interp) {
     if(interp->stack.size() < 2) {
         throw std::runtime_error("There must be two symbols: key, value on the stack");
@@ -78,22 +104,21 @@ void store_symbol(PfixInterpreter* interp) {
         auto val = interp->stack.pop();
         auto key = interp->stack.pop();
 
-        if(key->tag != TypeTag::SYM) {
+        if(key.tag != TypeTag::SYM) {
             throw std::runtime_error("Expected a symbol first");
         } else {
-            auto dict_key = dynamic_cast<Sym*>(key.get())->str;
-            sanitize_symbol(dict_key);
-            interp->dictionary[dict_key] = std::move(val);
+            interp->scope->bindings[binding_id(key.as<Sym>()->id)] = std::move(val);
         }
     }
 }
 
 void lam(PfixInterpreter* interp) {
-    if(interp->stack.size() < 1 || interp->stack.back()->tag != TypeTag::EXE_ARR) {
+    if(interp->stack.size() < 1 || interp->stack.back().tag != TypeTag::EXE_ARR) {
         throw std::runtime_error("Lambda expects one executable array");
     } else {
-        auto exe_arr = dynamic_cast<ExeArr*>(interp->stack.back().get());
-        exe_arr->add_dictionary(interp->dictionary);
+        auto exe_arr = interp->stack.back().as_unique<ExeArr>();
+        exe_arr->capture(interp->scope);
+        PfixCollector::local().track(interp->scope);
     }
 }
 
@@ -101,65 +126,67 @@ void fun(PfixInterpreter* interp) {
     if(interp->stack.size() < 2) {
         throw std::runtime_error("Expected two elements");
     } else {
-        auto exe_arr_ptr = interp->stack.pop();
+        interp->stack.expect(TypeTag::EXE_ARR);
+        auto exe_arr_val = interp->stack.pop();
         auto key_or_param = interp->stack.pop();
 
-        if(key_or_param->tag != TypeTag::SYM && key_or_param->tag != TypeTag::PARAMS) {
-            throw std::runtime_error("Expected a SYM / PARAM found " + type_to_string(key_or_param->tag));
+        if(key_or_param.tag != TypeTag::SYM && key_or_param.tag != TypeTag::PARAMS) {
+            throw std::runtime_error("Expected a SYM / PARAM found " + type_to_string(key_or_param.tag));
         } else {
             std::string key;
-            std::unique_ptr<Obj> key_ptr = NULL;
-            Params::Parameters parameters;
+            Value key_val;
+            Params* params = nullptr;
 
-            if(key_or_param->tag == TypeTag::PARAMS) {
-                key_ptr = interp->stack.pop();
-                auto params = dynamic_cast<Params*>(key_or_param.get());
-
-                parameters = params->params;
+            if(key_or_param.tag == TypeTag::PARAMS) {
+                key_val = interp->stack.pop();
+                params = key_or_param.as<Params>();
             } else {
-                key_ptr = std::move(key_or_param);
+                key_val = std::move(key_or_param);
             }
 
-            if(key_ptr->tag == TypeTag::SYM) {
-                key = dynamic_cast<Sym*>(key_ptr.get())->str;
+            if(key_val.tag == TypeTag::SYM) {
+                key = key_val.as<Sym>()->str();
                 sanitize_symbol(key);
             }
 
-            auto exe_arr = dynamic_cast<ExeArr*>(exe_arr_ptr.get());
-            exe_arr->add_dictionary(interp->dictionary);
+            auto exe_arr = exe_arr_val.as_unique<ExeArr>();
+            exe_arr->capture(interp->scope);
+            PfixCollector::local().track(interp->scope);
 
-            // Hijack executable array
-            if(!parameters.empty()) {
-                for(auto& it : parameters) {
-                    exe_arr->vec.push_front(std::make_unique<Sym>(it.first+"!"));  
-                }
+            // Recompile with the parameters bound to frame slots
+            if(params != nullptr && !params->params.empty()) {
+                exe_arr->code = compile(exe_arr->vec, *interp->scope, params);
             }
 
-            interp->dictionary[key] = std::move(exe_arr_ptr);
+            // The function finds itself through the captured scope
+            interp->scope->bindings[key] = std::move(exe_arr_val);
 
-            std::shared_ptr<Obj> o = interp->dictionary[key];
-            auto ref = dynamic_cast<ExeArr*>(o.get());
-            ref->dictionary[key] = o;
+            if(params != nullptr && !params->params.empty()) {
+                specialize(*exe_arr->code, *params, intern(key), *interp->scope);
+            }
         }
     }
 }
 
 void print_top(PfixStack* s) {
     if(s->size() > 0) {
-        s->back()->print(std::cout);
+        s->back().print(*s->context->out);
         s->pop_back();
     }
 }
 
-void int_to_flt(PfixStack* s, std::unique_ptr<Obj> x) {
-    s->push_back(std::make_unique<Flt>(dynamic_cast<Int*>(x.get())->i));
+void int_to_flt(PfixStack* s, Value x) {
+    if(!is_integer(x)) {
+        throw std::runtime_error("Expected :Int, found " + type_to_string(x.tag));
+    }
+    s->emplace_back(integer_to_double(x));
 }
 
-void type_to_symbol(PfixStack* s, std::unique_ptr<Obj> x) {
-    s->push_back(std::make_unique<Sym>(type_to_string(x->tag)));
+void type_to_symbol(PfixStack* s, Value x) {
+    s->push_back(std::make_unique<Sym>(type_to_string(x.tag)));
 }
 
-using UnaryFunc = std::function<void(PfixStack*, std::unique_ptr<Obj>)>;
+using UnaryFunc = std::function<void(PfixStack*, Value)>;
 
 void unary_op(PfixStack* s, UnaryFunc op) {
     if(s->size() > 0) {
@@ -169,234 +196,903 @@ void unary_op(PfixStack* s, UnaryFunc op) {
     }
 }
 
-void binary_int_op(PfixStack* s, std::function<int(int, int)> op) {
+inline bool is_number(const Value& x) {
+    return is_integer(x) || x.tag == TypeTag::FLT;
+}
+
+inline double to_double(const Value& x) {
+    return x.tag == TypeTag::FLT ? x.f : integer_to_double(x);
+}
+
+// x1 op x2 on unboxed :Int, in place of x1. Returns false and leaves x1
+// alone if the result does not fit into 64 bits.
+inline bool int_op(TypedOp op, Value& x1, int64_t x2) {
+    int64_t x = x1.i;
+    int64_t result;
+    switch(op) {
+        case TypedOp::ADD: if(__builtin_add_overflow(x, x2, &result)) return false; break;
+        case TypedOp::SUB: if(__builtin_sub_overflow(x, x2, &result)) return false; break;
+        case TypedOp::MUL: if(__builtin_mul_overflow(x, x2, &result)) return false; break;
+        case TypedOp::DIV:
+            if(x2 == 0) throw std::runtime_error("Division by zero");
+            if(x2 == -1 && x == INT64_MIN) return false;
+            result = x / x2;
+            break;
+        case TypedOp::MOD:
+            if(x2 == 0) throw std::runtime_error("Division by zero");
+            result = x2 == -1 ? 0 : x % x2;
+            break;
+        case TypedOp::LESS: x1 = Value(x < x2); return true;
+        case TypedOp::GREATER: x1 = Value(x > x2); return true;
+        case TypedOp::LESS_EQUAL: x1 = Value(x <= x2); return true;
+        case TypedOp::GREATER_EQUAL: x1 = Value(x >= x2); return true;
+        case TypedOp::EQUAL: x1 = Value(x == x2); return true;
+        case TypedOp::NOT_EQUAL: x1 = Value(x != x2); return true;
+        default: throw std::logic_error("Invalid integer operation");
+    }
+    x1.i = result;
+    return true;
+}
+
+// Arithmetic on :Int of any size, the result is promoted to a big integer
+// when it leaves 64 bits
+Value integer_op(TypedOp op, const Value& x1, const Value& x2) {
+    if(x1.tag == TypeTag::INT && x2.tag == TypeTag::INT) {
+        Value result = x1;
+        if(int_op(op, result, x2.i)) return result;
+    }
+    switch(op) {
+        case TypedOp::ADD: return integer_add(x1, x2);
+        case TypedOp::SUB: return integer_sub(x1, x2);
+        case TypedOp::MUL: return integer_mul(x1, x2);
+        case TypedOp::DIV: return integer_div(x1, x2);
+        case TypedOp::MOD: return integer_mod(x1, x2);
+        default: throw std::logic_error("Invalid integer operation");
+    }
+}
+
+double flt_op(TypedOp op, double x1, double x2) {
+    switch(op) {
+        case TypedOp::ADD: return x1 + x2;
+        case TypedOp::SUB: return x1 - x2;
+        case TypedOp::MUL: return x1 * x2;
+        case TypedOp::DIV: return x1 / x2;
+        default: throw std::logic_error("Invalid float operation");
+    }
+}
+
+void binary_int_op(PfixStack* s, TypedOp op) {
     if(s->size() < 2) {
         throw std::runtime_error("Binary operator expects two elements");
     }
     auto x2 = s->pop();
-    dynamic_cast<Int*>(s->back().get())->i =
-        op(dynamic_cast<Int*>(s->back().get())->i, dynamic_cast<Int*>(x2.get())->i);
+    auto& x1 = s->back();
+    if(!is_integer(x1) || !is_integer(x2)) {
+        throw std::runtime_error("Expected :Int, found " + type_to_string(is_integer(x1) ? x2.tag : x1.tag));
+    }
+    x1 = integer_op(op, x1, x2);
 }
 
-void binary_arith_op(PfixStack* s,
-        std::function<int(int, int)> int_op,
-        std::function<double(double, double)> flt_op,
-        bool int_ret_expect_float=false) {
+// :Int operands stay :Int, any :Flt operand makes the result a :Flt
+void binary_arith_op(PfixStack* s, TypedOp op) {
     if(s->size() < 2) {
         throw std::runtime_error("Binary operator expects two elements");
     }
     auto x2 = s->pop();
-    auto x1 = s->back().get();
+    auto& x1 = s->back();
 
-    if((x1->tag != TypeTag::INT && x1->tag != TypeTag::FLT)
-        || (x2->tag != TypeTag::INT && x2->tag != TypeTag::FLT)) {
+    if(x1.tag == TypeTag::INT && x2.tag == TypeTag::INT && int_op(op, x1, x2.i)) return;
+    if(!is_number(x1) || !is_number(x2)) {
         throw std::runtime_error("Invalid binary arithmetic operation");
-    } else if(x1->tag == TypeTag::INT && x2->tag == TypeTag::INT) {
-        if(int_ret_expect_float) {
-            s->back() = std::make_unique<Flt>(flt_op(dynamic_cast<Int*>(x1)->i, dynamic_cast<Int*>(x2.get())->i));
-        } else {
-            dynamic_cast<Int*>(x1)->i =
-                int_op(dynamic_cast<Int*>(x1)->i, dynamic_cast<Int*>(x2.get())->i);
-        }
+    } else if(is_integer(x1) && is_integer(x2)) {
+        x1 = integer_op(op, x1, x2);
     } else {
-        double res = 0.0;
-        if(x1->tag == TypeTag::FLT && x2->tag == TypeTag::FLT) {
-            res = flt_op(dynamic_cast<Flt*>(x1)->f, dynamic_cast<Flt*>(x2.get())->f);
-        } else if(x1->tag == TypeTag::INT && x2->tag == TypeTag::FLT) {
-            res = flt_op(dynamic_cast<Int*>(x1)->i, dynamic_cast<Flt*>(x2.get())->f);
-        } else if(x1->tag == TypeTag::FLT && x2->tag == TypeTag::INT) {
-            res = flt_op(dynamic_cast<Flt*>(x1)->f, dynamic_cast<Int*>(x2.get())->i);
-        }
-        s->back() = std::make_unique<Flt>(res);
+        x1 = Value(flt_op(op, to_double(x1), to_double(x2)));
     }
 }
 
-void binary_logical_op(PfixStack* s, std::function<bool(bool, bool)> bool_op) {
+// Division of :Int operands into a :Flt
+void divide_op(PfixStack* s) {
+    if(s->size() < 2) {
+        throw std::runtime_error("Binary operator expects two elements");
+    }
+    auto x2 = s->pop();
+    auto& x1 = s->back();
+    if(!is_number(x1) || !is_number(x2)) {
+        throw std::runtime_error("Invalid binary arithmetic operation");
+    }
+    x1 = Value(to_double(x1) / to_double(x2));
+}
+
+// Integer division, :Flt operands are truncated first
+void int_divide_op(PfixStack* s) {
+    if(s->size() < 2) {
+        throw std::runtime_error("Binary operator expects two elements");
+    }
+    auto x2 = s->pop();
+    auto& x1 = s->back();
+    if(!is_number(x1) || !is_number(x2)) {
+        throw std::runtime_error("Invalid binary arithmetic operation");
+    } else if(is_integer(x1) && is_integer(x2)) {
+        x1 = integer_op(TypedOp::DIV, x1, x2);
+    } else {
+        auto lhs = int64_t(to_double(x1));
+        auto rhs = int64_t(to_double(x2));
+        if(rhs == 0) throw std::runtime_error("Division by zero");
+        x1 = Value(rhs == -1 ? -double(lhs) : double(lhs / rhs));
+    }
+}
+
+template<typename BoolOp>
+void binary_logical_op(PfixStack* s, BoolOp bool_op) {
     if(s->size() < 2) {
         throw std::runtime_error("Binary operator expects two elements");
     }
     auto x = s->pop();
 
-    if(x->tag == TypeTag::ARR) {
+    if(x.tag == TypeTag::ARR) {
         // Multiple boolean values
-    } else if(x->tag == TypeTag::BOOL) {
+    } else if(x.tag == TypeTag::BOOL) {
         if(s->size() < 1) return;
-        dynamic_cast<Bool*>(s->back().get())->b =
-            bool_op(dynamic_cast<Bool*>(x.get())->b,
-                dynamic_cast<Bool*>(s->back().get())->b);
+        s->expect(TypeTag::BOOL);
+        s->back().b = bool_op(x.b, s->back().b);
     } else {
         // TODO error handling
     }
 }
 
+template<typename FltOp>
+void binary_compare_op(PfixStack* s, TypedOp op, FltOp flt_op) {
+    if(s->size() < 2) {
+        throw std::runtime_error("Comparison expects two elements");
+    }
+    auto x2 = s->pop();
+    auto& x1 = s->back();
+
+    if(x1.tag == TypeTag::INT && x2.tag == TypeTag::INT) {
+        int_op(op, x1, x2.i);
+    } else if(!is_number(x1) || !is_number(x2)) {
+        throw std::runtime_error("Invalid comparison");
+    } else if(is_integer(x1) && is_integer(x2)) {
+        x1 = Value(flt_op(integer_compare(x1, x2), 0));
+    } else {
+        x1 = Value((bool)flt_op(to_double(x1), to_double(x2)));
+    }
+}
+
+bool equals(const Value& x1, const Value& x2) {
+    if(is_integer(x1) && is_integer(x2)) return integer_compare(x1, x2) == 0;
+    if(x1.tag != x2.tag) {
+        return is_number(x1) && is_number(x2) && to_double(x1) == to_double(x2);
+    }
+
+    switch(x1.tag) {
+        case TypeTag::BOOL: return x1.b == x2.b;
+        case TypeTag::FLT: return x1.f == x2.f;
+        case TypeTag::STR: return x1.as<Str>()->str == x2.as<Str>()->str;
+        case TypeTag::SYM: return x1.as<Sym>()->id == x2.as<Sym>()->id;
+        default: return x1.obj == x2.obj;
+    }
+}
+
+void equal_op(PfixStack* s, bool negate) {
+    if(s->size() < 2) {
+        throw std::runtime_error("Comparison expects two elements");
+    }
+    auto x2 = s->pop();
+    auto x1 = s->pop();
+    s->emplace_back(equals(x1, x2) != negate);
+}
+
+void not_op(PfixStack* s, Value x) {
+    if(x.tag != TypeTag::BOOL) {
+        throw std::runtime_error("Expected :Bool, found " + type_to_string(x.tag));
+    }
+    s->emplace_back(!x.b);
+}
+
 void add_op(PfixStack* s) {
     if(s->size() < 2) {
         throw std::runtime_error("Binary operator expects two elements");
-    } else if(s->back()->tag == TypeTag::STR) {
+    } else if(s->back().tag == TypeTag::STR) {
         auto x2 = s->pop();
-        auto x1 = s->back().get();
-        if(x1->tag != TypeTag::STR) {
+        auto& x1 = s->back();
+        if(x1.tag != TypeTag::STR) {
             // TODO erro
         } else {
-            dynamic_cast<Str*>(x1)->str.append(dynamic_cast<Str*>(x2.get())->str);
+            x1.as_unique<Str>()->str.append(x2.as<Str>()->str);
         }
     } else {
-        binary_arith_op(s, std::plus<int>(), std::plus<double>());
+        binary_arith_op(s, TypedOp::ADD);
     }
 }
 
 void load_library(PfixInterpreter* interp) {
-    auto x = interp->stack.pop();
-    // TODO: check if x is actually a string
-    auto path = dynamic_cast<Str*>(x.get())->str;
+    interp->stack.expect(TypeTag::STR);
+    auto path = interp->stack.pop().as<Str>()->str;
 
     void* handle = dlopen(path.c_str(), RTLD_LAZY);
     if(handle == NULL) {
         throw std::runtime_error("Could not open " + path);
     }
 
-    const size_t period_idx = path.rfind('.');
-    if(std::string::npos != period_idx) {
-        path.erase(period_idx);
-        path[0] = std::toupper(path[0]);
+    // Entry points are named after the file: ./example.so => PfixExtensionExample
+    auto name = path.substr(path.rfind('/') + 1);
+    const size_t period_idx = name.rfind('.');
+    if(std::string::npos != period_idx) name.erase(period_idx);
+    if(!name.empty()) name[0] = std::toupper(name[0]);
+
+    if(!load_extension(handle, name, interp->globals->bindings)) {
+        throw std::runtime_error("No entry point for " + name + " in " + path);
     }
+}
 
-    auto method_name = "PfixInit" + path;
-    auto method = (PfixEntryPoint)dlsym(handle, method_name.c_str());
+void load_module(PfixInterpreter* interp) {
+    interp->stack.expect(TypeTag::STR);
+    auto path = interp->stack.pop().as<Str>()->str;
 
-    if(method != NULL) {
-        method(&interp->dictionary);
+    PfixModule module;
+    try {
+        run_module_file(*interp, path, module, interp->use_module_cache);
+    } catch(const PfixIOError&) {
+        throw;
+    } catch(const std::runtime_error& e) {
+        throw std::runtime_error(path + ":" + std::to_string(module.position.line) + ":"
+            + std::to_string(module.position.column) + ": " + e.what());
     }
 }
 
-void PfixInterpreter::evaluate_dictionary(std::string& sym) {
-    auto iter = dictionary.find(sym);
-    if(iter == dictionary.end()) {
-        throw std::runtime_error("Symbol '" + sym + "' is not defined");
+void PfixInterpreter::eval(std::string_view source) {
+    PfixModule module;
+    try {
+        module.compile(source, *scope);
+        module.run(*this);
+    } catch(const std::runtime_error& e) {
+        throw std::runtime_error(std::to_string(module.position.line) + ":"
+            + std::to_string(module.position.column) + ": " + e.what());
     }
-    auto& obj = iter->second;
+}
 
-    // If we found an executable array, use caution
-    // Native symbol, call method
-    // Otherwise just push the obj onto the stack
-    if(obj->tag == TypeTag::EXE_ARR) {
-        // Set the new dictionary
-        auto old_dict = std::move(dictionary);
-        auto exe_arr = dynamic_cast<ExeArr*>(obj.get());
-        dictionary = exe_arr->dictionary;
-
-        for(auto& x : exe_arr->vec) {
-            push(x->copy());
+void profile_folded(PfixInterpreter* interp) {
+    interp->stack.expect(TypeTag::STR);
+    auto path = interp->stack.pop().as<Str>()->str;
+
+    std::ofstream file(path);
+    interp->profiler.write_folded(file);
+    if(!file) throw std::runtime_error("Could not write " + path);
+}
+
+void profile_stop(PfixInterpreter* interp) {
+    interp->profiler.enabled = false;
+    interp->profiler.report(*interp->out);
+}
+
+void gc_stats(PfixInterpreter* interp) {
+    auto& alloc = pfix_alloc_stats();
+    auto& collector = PfixCollector::local();
+    *interp->out << "live: " << alloc.live_objects << " (" << alloc.live_bytes << " bytes)"
+        << " tracked: " << collector.tracked() << " scopes "
+        << collector.stats() << std::endl;
+}
+
+inline bool fused_int_op(PfixStack& stack, const Value& operand, TypedOp op) {
+    if(stack.empty() || stack.back().tag != TypeTag::INT || operand.tag != TypeTag::INT) return false;
+    return int_op(op, stack.back(), operand.i);
+}
+
+inline Value typed_op(TypedOp op, double x1, double x2) {
+    switch(op) {
+        case TypedOp::ADD: return Value(x1 + x2);
+        case TypedOp::SUB: return Value(x1 - x2);
+        case TypedOp::MUL: return Value(x1 * x2);
+        case TypedOp::DIV: return Value(x1 / x2);
+        case TypedOp::MOD: break;
+        case TypedOp::LESS: return Value(x1 < x2);
+        case TypedOp::GREATER: return Value(x1 > x2);
+        case TypedOp::LESS_EQUAL: return Value(x1 <= x2);
+        case TypedOp::GREATER_EQUAL: return Value(x1 >= x2);
+        case TypedOp::EQUAL: return Value(x1 == x2);
+        case TypedOp::NOT_EQUAL: return Value(x1 != x2);
+    }
+    throw std::logic_error("Invalid typed operation");
+}
+
+// Dispatch loop over the frames above run_base.
+// Calls push a frame and continue here, so the native stack does not
+// grow with the depth of the program.
+void PfixInterpreter::run() {
+    while(frames.size() > run_base) {
+        if(frames.back().code->definitions != PfixDictionary::definitions) revalidate(frames.back());
+
+        auto& instructions = frames.back().code->instructions;
+        auto& constants = frames.back().code->constants;
+        auto& caches = frames.back().code->caches;
+        size_t pc = frames.back().pc;
+        bool called = false;
+
+        while(!called && pc < instructions.size()) {
+            auto& ins = instructions[pc++];
+            switch(ins.op) {
+                case OpCode::PUSH_CONST:
+                    stack.push_back(constants[ins.arg]);
+                    break;
+                case OpCode::CALL: {
+                    frames.back().pc = pc;
+                    auto& cache = caches[pc - 1];
+                    if(cache.epoch == PfixDictionary::epoch && PfixDictionary::shadow_count(ins.arg) == 0) {
+                        invoke(ins.arg, cache.binding);
+                    } else {
+                        invoke(ins.arg, resolve(ins.arg, &cache));
+                    }
+                    called = true;
+                    break;
+                }
+                case OpCode::STORE:
+                    if(stack.empty()) throw std::runtime_error("No value to store on the stack");
+                    scope->bindings[ins.arg] = stack.pop();
+                    // Rebinding a watched word, the rest of the frame may assume the old one
+                    if(frames.back().code->definitions != PfixDictionary::definitions) {
+                        frames.back().pc = pc;
+                        called = true;
+                    }
+                    break;
+                case OpCode::LOAD_LOCAL:
+                    stack.push_back(locals[frame_base + ins.arg]);
+                    break;
+                case OpCode::STORE_LOCAL:
+                    if(stack.empty()) throw std::runtime_error("No value to store on the stack");
+                    locals[frame_base + ins.arg] = stack.pop();
+                    break;
+                case OpCode::JUMP:
+                    pc = ins.arg;
+                    break;
+                case OpCode::JUMP_IF_FALSE:
+                    stack.expect(TypeTag::BOOL);
+                    if(!stack.pop().b) pc = ins.arg;
+                    break;
+                case OpCode::ADD_CONST:
+                    if(fused_int_op(stack, constants[ins.arg], TypedOp::ADD)) break;
+                    frames.back().pc = pc;
+                    call_fused(ins.op, constants[ins.arg]);
+                    called = true;
+                    break;
+                case OpCode::SUB_CONST:
+                    if(fused_int_op(stack, constants[ins.arg], TypedOp::SUB)) break;
+                    frames.back().pc = pc;
+                    call_fused(ins.op, constants[ins.arg]);
+                    called = true;
+                    break;
+                case OpCode::LESS_CONST:
+                    if(fused_int_op(stack, constants[ins.arg], TypedOp::LESS)) break;
+                    frames.back().pc = pc;
+                    call_fused(ins.op, constants[ins.arg]);
+                    called = true;
+                    break;
+                case OpCode::GREATER_CONST:
+                    if(fused_int_op(stack, constants[ins.arg], TypedOp::GREATER)) break;
+                    frames.back().pc = pc;
+                    call_fused(ins.op, constants[ins.arg]);
+                    called = true;
+                    break;
+                case OpCode::LESS_EQUAL_CONST:
+                    if(fused_int_op(stack, constants[ins.arg], TypedOp::LESS_EQUAL)) break;
+                    frames.back().pc = pc;
+                    call_fused(ins.op, constants[ins.arg]);
+                    called = true;
+                    break;
+                case OpCode::GREATER_EQUAL_CONST:
+                    if(fused_int_op(stack, constants[ins.arg], TypedOp::GREATER_EQUAL)) break;
+                    frames.back().pc = pc;
+                    call_fused(ins.op, constants[ins.arg]);
+                    called = true;
+                    break;
+                case OpCode::INT_OP: {
+                    int64_t x2 = stack.back().i;
+                    stack.pop_back();
+                    if(!int_op(TypedOp(ins.arg), stack.back(), x2)) {
+                        frames.back().pc = pc;
+                        promote(TypedOp(ins.arg), x2);
+                        called = true;
+                    }
+                    break;
+                }
+                case OpCode::FLT_OP: {
+                    double x2 = stack.back().f;
+                    stack.pop_back();
+                    stack.back() = typed_op(TypedOp(ins.arg), stack.back().f, x2);
+                    break;
+                }
+                case OpCode::INT_CONST_OP:
+                    if(!int_op(TypedOp(ins.arg & 0xff), stack.back(), constants[ins.arg >> 8].i)) {
+                        frames.back().pc = pc;
+                        promote(TypedOp(ins.arg & 0xff), constants[ins.arg >> 8].i);
+                        called = true;
+                    }
+                    break;
+            }
+        }
+
+        if(!called) leave();
+    }
+}
+
+// A word the optimizer assumed to be a builtin was redefined,
+// the frame continues in the baseline instructions
+void PfixInterpreter::revalidate(Frame& frame) {
+    auto& code = *frame.code;
+    if(code.assumptions_hold()) {
+        // Arrays check their inlined words when they are entered again
+        if(code.inlining_holds()) code.definitions = PfixDictionary::definitions;
+        return;
+    }
+
+    frame.pc = code.baseline_pc[frame.pc];
+    frame.code = code.deoptimized();
+}
+
+// Typed :Int arithmetic overflowed. The result becomes a big integer, which
+// neither the frame nor typed callers relying on its signature expect, so
+// every optimized frame continues in its baseline instructions.
+void PfixInterpreter::promote(TypedOp op, int64_t x2) {
+    stack.back() = integer_op(op, stack.back(), Value(x2));
+    for(auto& frame : frames) {
+        if(frame.code->baseline.empty()) continue;
+        frame.pc = frame.code->baseline_pc[frame.pc];
+        frame.code = frame.code->deoptimized();
+    }
+}
+
+// Superinstructions fall back to the word they stand for unless both
+// operands are integers. A scope may bind the word to anything, so it is
+// invoked like any other call.
+void PfixInterpreter::call_fused(OpCode op, const Value& operand) {
+    stack.push_back(operand);
+    SymbolId id = fused_word(op);
+    invoke(id, resolve(id));
+}
+
+// Whether only jumps to the end are left in the frame
+bool PfixInterpreter::is_finished(const Frame& frame) const {
+    auto& instructions = frame.code->instructions;
+    size_t pc = frame.pc;
+    for(size_t n = 0; n < instructions.size() && pc < instructions.size() && instructions[pc].op == OpCode::JUMP; n++) {
+        pc = instructions[pc].arg;
+    }
+    return pc >= instructions.size();
+}
+
+void PfixInterpreter::enter(std::shared_ptr<Code> code, PfixEnvironment env) {
+    // A call in tail position replaces the frame of its caller
+    if(frames.size() > run_base && is_finished(frames.back())) leave();
+
+    if(frames.size() >= max_depth) {
+        throw std::runtime_error("Maximum call depth of " + std::to_string(max_depth) + " exceeded");
+    }
+
+    uint32_t num_locals = code->num_locals;
+    frames.push_back({std::move(code), 0, std::move(scope), frame_base, false});
+    scope = std::move(env);
+    frame_base = locals.size();
+    locals.resize(frame_base + num_locals);
+}
+
+const std::shared_ptr<Code>& PfixInterpreter::prepare(ExeArr* exe_arr) {
+    auto& code = exe_arr->code;
+    if(!code) {
+        code = compile(exe_arr->vec, *scope);
+    } else if(code->definitions != PfixDictionary::definitions) {
+        if(!code->inlining_holds()) code = recompile(*code, exe_arr->vec, *scope);
+        else if(!code->assumptions_hold()) code = code->deoptimized();
+    }
+    return code;
+}
+
+void PfixInterpreter::enter(ExeArr* exe_arr) {
+    prepare(exe_arr);
+
+    // Run the body on top of the captured scope, arrays without a captured
+    // scope see the scope of the caller. Only bodies that bind names at
+    // run time get a fresh scope, parameters live in slots of the frame.
+    auto env = exe_arr->env ? exe_arr->env : scope;
+    if(exe_arr->code->needs_scope) env = std::make_shared<PfixScope>(std::move(env));
+
+    // Arguments of the declared types run the typed variant
+    auto& typed = exe_arr->code->typed;
+    if(typed && is_guarded(exe_arr->code->guard)) {
+        if(typed->definitions == PfixDictionary::definitions || typed->assumptions_hold()) {
+#ifdef PFIX_JIT
+            if(!profiler.enabled && call_native(*typed, exe_arr->code->guard)) return;
+#endif
+            enter(typed, std::move(env));
+            return;
         }
+        typed.reset();
+    }
+    enter(exe_arr->code, std::move(env));
+}
+
+#ifdef PFIX_JIT
+// Run a hot typed variant as machine code. Returns false if it cannot be
+// compiled or gave up, the call then runs in the interpreter from the start.
+bool PfixInterpreter::call_native(Code& code, const std::vector<TypeTag>& guard) {
+    if(!code.native) {
+        if(code.calls >= JIT_THRESHOLD || ++code.calls < JIT_THRESHOLD) return false;
+        code.native = jit_compile(code, guard);
+        if(!code.native) return false;
+    }
+
+    // Retrying every deeper call would run JIT_MAX_DEPTH native calls per frame
+    if(frames.size() > native_bail_depth) return false;
+    native_bail_depth = SIZE_MAX;
+
+    // Native calls are bounded by the native stack and what is left of max_depth
+    JitContext context;
+    context.depth = std::min<int64_t>(JIT_MAX_DEPTH, max_depth - std::min(max_depth, frames.size()));
+    context.bailed = 0;
+
+    size_t n = guard.size();
+    int64_t args[JIT_MAX_PARAMS];
+    for(size_t i = 0; i < n; i++) args[n - 1 - i] = stack[stack.size() - n + i].i;
+
+    int64_t result = (*code.native)(args, &context);
+    if(context.bailed) {
+        // Only running out of depth leaves the counter below zero
+        if(context.depth < 0) native_bail_depth = frames.size();
+        return false;
+    }
+
+    stack.resize(stack.size() - n);
+    stack.emplace_back(result);
+    return true;
+}
+#endif
+
+bool PfixInterpreter::is_guarded(const std::vector<TypeTag>& guard) const {
+    if(stack.size() < guard.size()) return false;
+    size_t base = stack.size() - guard.size();
+    for(size_t i = 0; i < guard.size(); i++) {
+        if(stack[base + i].tag != guard[i]) return false;
+    }
+    return true;
+}
+
+void PfixInterpreter::leave() {
+    auto& frame = frames.back();
+    scope = std::move(frame.caller_scope);
+    locals.resize(frame_base);
+    frame_base = frame.caller_base;
+    if(frame.profiled) profiler.leave();
+    frames.pop_back();
+}
+
+// Frames below the current run_base belong to an enclosing run and are
+// left alone, even when an error unwinds this one
+template<typename F>
+void PfixInterpreter::run_nested(F start) {
+    size_t outer_base = run_base;
+    run_base = frames.size();
+    try {
+        start();
+        run();
+    } catch(...) {
+        while(frames.size() > run_base) leave();
+        run_base = outer_base;
+        throw;
+    }
+    run_base = outer_base;
+}
+
+void PfixInterpreter::call(ExeArr* exe_arr) {
+    run_nested([&]() { enter(exe_arr); });
+}
+
+void PfixInterpreter::run_block(std::shared_ptr<Code> code) {
+    run_nested([&]() { enter(std::move(code), scope); });
+}
+
+// Symbols that no nested scope binds resolve to the globals from every
+// scope, so the call site can keep the binding
+PfixDictionary::Binding* PfixInterpreter::resolve(SymbolId id, InlineCache* cache) {
+    auto entry = scope->lookup(id);
+    if(entry == nullptr && bind_missing && bind_missing(id)) entry = scope->lookup(id);
+    if(entry == nullptr) {
+        throw std::runtime_error("Symbol '" + symbol_name(id) + "' is not defined");
+    }
+
+    if(cache != nullptr && PfixDictionary::shadow_count(id) == 0) {
+        cache->binding = entry;
+        cache->epoch = PfixDictionary::epoch;
+    }
+    return entry;
+}
+
+void PfixInterpreter::invoke(SymbolId id, PfixDictionary::Binding* entry) {
+    if(profiler.enabled) return invoke_profiled(id, entry);
+
+    // If we found an executable array, schedule its compiled body
+    // Native symbol, call method
+    // Otherwise just push the value onto the stack
+    if(entry->tag == TypeTag::EXE_ARR) {
+        enter(entry->as<ExeArr>());
+    } else if(entry->tag == TypeTag::NATIVE_SYM) {
+        entry->as<NativeSym>()->call(&stack);
+    } else {
+        stack.push_back(*entry);
+    }
+}
 
-        // Reset
-        dictionary = std::move(old_dict);
-    } else if(obj->tag == TypeTag::NATIVE_SYM) {
-        auto nsym = dynamic_cast<NativeSym*>(obj.get());
-        nsym->function(&stack);
+// Natives are timed around the call, executable arrays until their frame is left
+void PfixInterpreter::invoke_profiled(SymbolId id, PfixDictionary::Binding* entry) {
+    if(entry->tag == TypeTag::EXE_ARR) {
+        enter(entry->as<ExeArr>());
+        profiler.enter(id);
+        frames.back().profiled = true;
+    } else if(entry->tag == TypeTag::NATIVE_SYM) {
+        profiler.enter(id);
+        try {
+            entry->as<NativeSym>()->call(&stack);
+        } catch(...) {
+            profiler.leave();
+            throw;
+        }
+        profiler.leave();
     } else {
-        stack.push_back(obj->copy());
+        stack.push_back(*entry);
     }
 }
 
-void PfixInterpreter::evaluate_symbol(std::string& sym) {
+void PfixInterpreter::evaluate_dictionary(SymbolId id) {
+    run_nested([&]() { invoke(id, resolve(id)); });
+}
+
+void PfixInterpreter::evaluate_symbol(const Sym& sym) {
     // If the symbol ends with an exclamation mark, store it
-    if(sym[sym.size()-1] == '!') {
-        sym.pop_back();
+    if(sym.store) {
         if(stack.size() > 0) {
-            dictionary[sym] = stack.pop();
+            auto& name = symbol_name(sym.id);
+            scope->bindings[name.substr(0, name.size()-1)] = stack.pop();
         } else {
             throw std::runtime_error("No value to store on the stack");
         }
     // Otherwise try to find its definition
     } else {
-        evaluate_dictionary(sym);
+        evaluate_dictionary(sym.id);
     }
 }
 
-constexpr int divides_int(double lhs, double rhs) {
-    return (int)lhs / (int)rhs;
-}
-
 // cond {if} {else} if
 // cond {if} if
 void if_cond(PfixInterpreter* interp) {
     interp->stack.expect(TypeTag::EXE_ARR);
     auto x = interp->stack.pop();
-    std::unique_ptr<Obj> y = NULL;
+    Value y;
 
     // There exists an if part after the else part
-    if(!interp->stack.empty() && interp->stack.back()->tag == TypeTag::EXE_ARR) {
+    if(!interp->stack.empty() && interp->stack.back().tag == TypeTag::EXE_ARR) {
         y = interp->stack.pop();
     }
 
     interp->stack.expect(TypeTag::BOOL);
-    if(dynamic_cast<Bool*>(interp->stack.pop().get())->b) {
+    Value branch;
+    if(interp->stack.pop().b) {
         // There is only one value (x)
-        if(y == NULL) {
-            interp->push(std::move(x));
+        if(y.obj == nullptr) {
+            branch = std::move(x);
         // There are two values y, x
         } else {
-            interp->push(std::move(y));
+            branch = std::move(y);
         }
     } else {
         // There are two values y, x
-        if(y != NULL) {
-            interp->push(std::move(x));
+        if(y.obj != nullptr) {
+            branch = std::move(x);
         }
     }
 
+    // Branches run in the scope of the caller
+    if(branch.obj != nullptr) {
+        interp->enter(interp->prepare(branch.as<ExeArr>()), interp->scope);
+    }
 }
 
-void PfixInterpreter::load_builtins() {
+// Loops whose blocks are pushed before the word are compiled as if they
+// had been written out, so that every iteration runs in the same frame.
+// Returns false if that would not compile the loop in place, because a
+// builtin its counter uses was redefined.
+bool run_compiled_loop(PfixInterpreter* interp, const std::string& word, size_t blocks) {
+    auto& stack = interp->stack;
+    if(stack.size() < blocks) return false;
+
+    std::vector<const ExeArr*> arrays;
+    for(size_t i = stack.size() - blocks; i < stack.size(); i++) {
+        if(stack[i].tag != TypeTag::EXE_ARR) return false;
+        arrays.push_back(stack[i].as<ExeArr>());
+    }
+    auto code = compile_loop(word, arrays, *interp->scope);
+    if(!code) return false;
+
+    stack.resize(stack.size() - blocks);
+    interp->run_block(std::move(code));
+    return true;
+}
+
+// Otherwise the blocks run one at a time. break throws in them, as it is
+// not written inside a loop.
+template<typename F>
+void until_break(F iterate) {
+    try {
+        iterate();
+    } catch(const PfixBreak&) {}
+}
+
+ExeArr* pop_body(PfixInterpreter* interp, Value& body) {
+    interp->stack.expect(TypeTag::EXE_ARR);
+    body = interp->stack.pop();
+    auto exe_arr = body.as<ExeArr>();
+    interp->prepare(exe_arr);
+    return exe_arr;
+}
+
+void loop(PfixInterpreter* interp) {
+    if(run_compiled_loop(interp, "loop", 1)) return;
+    Value holder;
+    auto body = pop_body(interp, holder);
+    until_break([&]() {
+        for(;;) interp->run_block(body->code);
+    });
+}
+
+void while_loop(PfixInterpreter* interp) {
+    if(run_compiled_loop(interp, "while", 2)) return;
+    Value body_holder, cond_holder;
+    auto body = pop_body(interp, body_holder);
+    auto cond = pop_body(interp, cond_holder);
+    until_break([&]() {
+        for(;;) {
+            interp->run_block(cond->code);
+            interp->stack.expect(TypeTag::BOOL);
+            if(!interp->stack.pop().b) return;
+            interp->run_block(body->code);
+        }
+    });
+}
+
+void times(PfixInterpreter* interp) {
+    if(run_compiled_loop(interp, "times", 1)) return;
+    Value holder;
+    auto body = pop_body(interp, holder);
+    int64_t n = interp->stack.popInt();
+    until_break([&]() {
+        for(int64_t i = 0; i < n; i++) interp->run_block(body->code);
+    });
+}
+
+// first last step {body} for-step, with a negative step down to last.
+// A step of 0 runs no iteration.
+void for_loop(PfixInterpreter* interp, bool has_step) {
+    if(run_compiled_loop(interp, has_step ? "for-step" : "for", 1)) return;
+    auto& stack = interp->stack;
+    Value holder;
+    auto body = pop_body(interp, holder);
+    int64_t step = has_step ? stack.popInt() : 1;
+    int64_t last = stack.popInt();
+    int64_t first = stack.popInt();
+
+    until_break([&]() {
+        for(int64_t i = first; step > 0 ? i < last : step < 0 && i > last;) {
+            stack.push_back(Value(i));
+            interp->run_block(body->code);
+            if(__builtin_add_overflow(i, step, &i)) break;
+        }
+    });
+}
+
+static PfixDictionary make_builtin_table() {
+    PfixDictionary table;
     const std::map<std::string, PfixStackFunction> builtins = {
-        {{"+"}, [](PfixStack* s) { add_op(s); }},
-        {{"-"}, [](PfixStack* s) { binary_arith_op(s, std::minus<int>(), std::minus<double>()); }},
-        {{"*"}, [](PfixStack* s) { binary_arith_op(s, std::multiplies<int>(), std::multiplies<double>()); }},
-        {{"/"}, [](PfixStack* s) { binary_arith_op(s, std::divides<double>(), std::divides<double>(), true); }},
-        {{"i/"}, [](PfixStack* s) { binary_arith_op(s, std::divides<int>(), divides_int); }},
-        {{"mod"}, [](PfixStack* s) { binary_int_op(s, std::modulus<int>()); }},
+        {{"+"}, [](PfixStack* s) { if(!packed_arith(s, ArrOp::ADD)) add_op(s); }},
+        {{"-"}, [](PfixStack* s) { if(!packed_arith(s, ArrOp::SUB)) binary_arith_op(s, TypedOp::SUB); }},
+        {{"*"}, [](PfixStack* s) { if(!packed_arith(s, ArrOp::MUL)) binary_arith_op(s, TypedOp::MUL); }},
+        {{"/"}, [](PfixStack* s) { if(!packed_arith(s, ArrOp::DIV)) divide_op(s); }},
+        {{"i/"}, [](PfixStack* s) { int_divide_op(s); }},
+        {{"mod"}, [](PfixStack* s) { binary_int_op(s, TypedOp::MOD); }},
         {{"and"}, [](PfixStack* s) { binary_logical_op(s, std::logical_and<bool>()); }},
         {{"or"}, [](PfixStack* s) { binary_logical_op(s, std::logical_or<bool>()); }},
+        {{"not"}, [](PfixStack* s) { unary_op(s, not_op); }},
+        {{"<"}, [](PfixStack* s) { binary_compare_op(s, TypedOp::LESS, std::less<double>()); }},
+        {{">"}, [](PfixStack* s) { binary_compare_op(s, TypedOp::GREATER, std::greater<double>()); }},
+        {{"<="}, [](PfixStack* s) { binary_compare_op(s, TypedOp::LESS_EQUAL, std::less_equal<double>()); }},
+        {{">="}, [](PfixStack* s) { binary_compare_op(s, TypedOp::GREATER_EQUAL, std::greater_equal<double>()); }},
+        {{"="}, [](PfixStack* s) { equal_op(s, false); }},
+        {{"!="}, [](PfixStack* s) { equal_op(s, true); }},
         {{"int->flt"}, [](PfixStack* s) { unary_op(s, int_to_flt); }},
+        {{"sum"}, [](PfixStack* s) { array_sum(s); }},
+        {{"min"}, [](PfixStack* s) { array_min(s); }},
+        {{"max"}, [](PfixStack* s) { array_max(s); }},
+        {{"dot"}, [](PfixStack* s) { array_dot(s); }},
+        {{"range"}, [](PfixStack* s) { array_range(s); }},
+        {{"map"}, [](PfixStack* s) { array_map(s->context); }},
+        {{"filter"}, [](PfixStack* s) { array_filter(s->context); }},
+        {{"reduce"}, [](PfixStack* s) { array_reduce(s->context); }},
+        {{"fold"}, [](PfixStack* s) { array_reduce(s->context); }},
+        {{"each"}, [](PfixStack* s) { array_each(s->context); }},
+        {{"pmap"}, [](PfixStack* s) { array_pmap(s->context); }},
+        {{"preduce"}, [](PfixStack* s) { array_preduce(s->context); }},
         {{"print"}, [](PfixStack* s) { print_top(s); }},
-        {{"println"}, [](PfixStack* s) { print_top(s); std::cout << std::endl; }},
+        {{"println"}, [](PfixStack* s) { print_top(s); *s->context->out << std::endl; }},
         {{"clear"}, [](PfixStack* s) { s->clear(); }},
+        {{"alloc-stats"}, [](PfixStack* s) { *s->context->out << pfix_alloc_stats() << std::endl; }},
+        {{"gc"}, [](PfixStack* s) { PfixCollector::local().collect(true); }},
+        {{"gc-stats"}, [](PfixStack* s) { gc_stats(s->context); }},
+        {{"profile-start"}, [](PfixStack* s) { s->context->profiler.enabled = true; }},
+        {{"profile-stop"}, [](PfixStack* s) { profile_stop(s->context); }},
+        {{"profile-folded"}, [](PfixStack* s) { profile_folded(s->context); }},
         {{"type"}, [](PfixStack* s) { unary_op(s, type_to_symbol); }},
         {{"]"}, [](PfixStack* s) { arr_close(s); }},
         {{")"}, [](PfixStack* s) { param_list_close(s); }},
-        {{"stack"}, [this](PfixStack* s) { std::cout << *this << std::endl; }},
-        {{"dict"}, [this](PfixStack* s) { this->dictionary.print(std::cout); }},
-        {{"!"}, [this](PfixStack* s) { store_symbol(this); }},
-        {{"lam"}, [this](PfixStack* s) { lam(this); }},
-        {{"fun"}, [this](PfixStack* s) { fun(this); }},
-        {{"if"}, [this](PfixStack* s) { if_cond(this); }},
-        {{"load-library"}, [this](PfixStack* s) { load_library(this); }}
+        {{"stack"}, [](PfixStack* s) { *s->context->out << *s->context << std::endl; }},
+        {{"dict"}, [](PfixStack* s) { s->context->globals->bindings.print(*s->context->out); }},
+        {{"!"}, [](PfixStack* s) { store_symbol(s->context); }},
+        {{"lam"}, [](PfixStack* s) { lam(s->context); }},
+        {{"fun"}, [](PfixStack* s) { fun(s->context); }},
+        {{"if"}, [](PfixStack* s) { if_cond(s->context); }},
+        {{"loop"}, [](PfixStack* s) { loop(s->context); }},
+        {{"while"}, [](PfixStack* s) { while_loop(s->context); }},
+        {{"times"}, [](PfixStack* s) { times(s->context); }},
+        {{"for"}, [](PfixStack* s) { for_loop(s->context, false); }},
+        {{"for-step"}, [](PfixStack* s) { for_loop(s->context, true); }},
+        {{"break"}, [](PfixStack* s) { throw PfixBreak(); }},
+        {{"load-library"}, [](PfixStack* s) { load_library(s->context); }},
+        {{"load"}, [](PfixStack* s) { load_module(s->context); }}
+    };
+
+    // Builtins without side effects, evaluated at compile time on constants
+    const char* pure[] = {
+        "+", "-", "*", "/", "i/", "mod", "and", "or", "not",
+        "<", ">", "<=", ">=", "=", "!=", "int->flt", "type"
     };
 
     for(auto& it : builtins) {
-        dictionary.emplace(it.first, std::make_unique<NativeSym>(it.second));
+        table.define_native(it.first, it.second);
+    }
+    for(auto name : pure) {
+        table.find(intern(name))->as<NativeSym>()->pure = true;
     }
+    return table;
 }
 
-void PfixInterpreter::push(std::unique_ptr<Obj> obj) {
-    if(obj->tag == TypeTag::SYM) {
-        auto sym = dynamic_cast<Sym*>(obj.get())->str;
-        if(sym[0] == ':' || sym[sym.size()-1] == ':' || sym == "[" || sym == "->") {
+// Never destroyed, threads may still copy from it while the program exits
+const PfixDictionary& builtin_table() {
+    static const PfixDictionary& table = *new PfixDictionary(make_builtin_table());
+    return table;
+}
+
+// The natives are copied rather than shared, the table is used by all threads
+void PfixInterpreter::load_builtins() {
+    builtin_table().for_each([this](SymbolId id, const PfixDictionary::Binding& builtin) {
+        if(globals->bindings.find(id) == nullptr) globals->bindings[id] = builtin.obj->copy();
+    });
+}
+
+void PfixInterpreter::push(Value obj) {
+    if(obj.tag == TypeTag::SYM) {
+        auto sym = obj.as<Sym>();
+        auto id = sym->id;
+        if(sym->literal) {
             stack.push_back(std::move(obj));
-        } else if(sym == "(") {
+        } else if(id == SYM_LPAREN) {
             stack.push_back(std::move(obj));
             evaluate_on_push = false;
-        } else if(sym == ")") {
+        } else if(id == SYM_RPAREN) {
             evaluate_on_push = true;
             param_list_close(&stack);    
-        } else if(sym == "{") {
+        } else if(id == SYM_LBRACE) {
             stack.push_back(std::move(obj));
 
             evaluate_on_push = false;
             if(exe_arr == 0) exe_begin = stack.size();
             exe_arr++;
-        } else if(sym == "}") {
+        } else if(id == SYM_RBRACE) {
             exe_arr--;
             if(exe_arr < 0) {
                 throw std::runtime_error("Closing executable array without beginning");
@@ -404,18 +1100,20 @@ void PfixInterpreter::push(std::unique_ptr<Obj> obj) {
                 evaluate_on_push = true;
 
                 // Move range from stack into array
-                std::vector<std::unique_ptr<Obj>> arr;
+                std::vector<Value> arr;
                 auto start = std::next(stack.begin(), exe_begin);
                 std::move(start, stack.end(), std::back_inserter(arr));
                 stack.erase(std::prev(start), stack.end());
 
-                // Push newly created executable array onto the stack
-                stack.push_back(std::make_unique<ExeArr>(std::move(arr)));
+                // Compile and push the newly created executable array onto the stack
+                auto exe_arr = std::make_unique<ExeArr>(std::move(arr));
+                exe_arr->code = compile(exe_arr->vec, *scope);
+                stack.push_back(std::move(exe_arr));
             } else {
                 stack.push_back(std::move(obj));
             }
         } else {
-            if(evaluate_on_push) evaluate_symbol(sym);
+            if(evaluate_on_push) evaluate_symbol(*sym);
             else stack.push_back(std::move(obj));
         }
     } else {
@@ -423,12 +1121,31 @@ void PfixInterpreter::push(std::unique_ptr<Obj> obj) {
     }
 }
 
+Value token_value(const Token& token) {
+    switch(token.type) {
+        case TokenType::STR: {
+            return std::make_unique<Str>(std::string(token.text));
+        }
+        case TokenType::BOOL: return Value(token.b);
+        case TokenType::INT: return Value(token.i);
+        case TokenType::BIG_INT: return parse_big_integer(token.text);
+        case TokenType::FLT: return Value(token.f);
+        case TokenType::SYM: return std::make_unique<Sym>(token.text);
+        case TokenType::EOL: break;
+    }
+    return Value();
+}
+
+void PfixInterpreter::push_token(const Token& token) {
+    if(token.type != TokenType::EOL) push(token_value(token));
+}
+
 std::ostream& operator<<(std::ostream& os, PfixInterpreter& interp) {
     bool comma = false;
     os << "[";
     std::for_each(interp.stack.begin(), interp.stack.end(), [&os, &comma](auto& x) {
         if(comma) os << ", ";
-        x->print(os);
+        x.print(os);
         comma = true;
     });
     os << "]";
@@ -2,28 +2,130 @@
 #define __PFIX_INTERPRETER_HPP__
 
 #include "types.hpp"
+#include "compiler.hpp"
+#include "lexer.hpp"
+#include "profiler.hpp"
 
 #include <string>
 #include <dlfcn.h>
 
 void sanitize_symbol(std::string& sym);
+void param_list_close(PfixStack* s);
+Value token_value(const Token& token);
 
+// Thrown by break outside of the loops it is written in, which jump to
+// their end instead. Loops that run their blocks one at a time stop on it.
+class PfixBreak : public std::runtime_error {
+public:
+    PfixBreak() : std::runtime_error("break outside of a loop") {}
+};
+
+// Natives of all builtin words, built once and shared by all interpreters
+const PfixDictionary& builtin_table();
+
+// An interpreter context with its own stack, scopes and compiled code.
+// Separate interpreters share no mutable state but the symbol table, which
+// is locked, so they may run concurrently on different threads. An
+// interpreter and its values stay on the thread that created it; it may be
+// kept and reused for further evaluations there.
 class PfixInterpreter {
 private:
     bool evaluate_on_push = true;
     int exe_arr = 0;
     int exe_begin;
 
-    void evaluate_dictionary(std::string& sym);
-    void evaluate_symbol(std::string& sym);
+    // Parameter slots of all active calls, frame_base is the first
+    // slot of the innermost one
+    std::vector<Value> locals;
+    size_t frame_base = 0;
+
+    // An active call, with the state of its caller to restore on return
+    struct Frame {
+        std::shared_ptr<Code> code;
+        size_t pc;
+        PfixEnvironment caller_scope;
+        size_t caller_base;
+        bool profiled;
+    };
+
+    // Call stack of the dispatch loop, the innermost run owns the frames
+    // from run_base upwards
+    std::vector<Frame> frames;
+    size_t run_base = 0;
+
+    void run();
+    template<typename F>
+    void run_nested(F start);
+    bool is_finished(const Frame& frame) const;
+    void revalidate(Frame& frame);
+    bool is_guarded(const std::vector<TypeTag>& guard) const;
+#ifdef PFIX_JIT
+    bool call_native(Code& code, const std::vector<TypeTag>& guard);
+
+    // Number of frames when native code last ran out of depth, the call is
+    // then interpreted and its nested calls stay in the interpreter
+    size_t native_bail_depth = SIZE_MAX;
+#endif
+    void call_fused(OpCode op, const Value& operand);
+    void promote(TypedOp op, int64_t x2);
+    void leave();
+    PfixDictionary::Binding* resolve(SymbolId id, InlineCache* cache = nullptr);
+    void invoke(SymbolId id, PfixDictionary::Binding* entry);
+    void invoke_profiled(SymbolId id, PfixDictionary::Binding* entry);
+
+    void evaluate_dictionary(SymbolId id);
+    void evaluate_symbol(const Sym& sym);
 
 public:
+    PfixInterpreter() { stack.context = this; }
+    PfixInterpreter(const PfixInterpreter&) = delete;
+    PfixInterpreter& operator=(const PfixInterpreter&) = delete;
+
     PfixStack stack;
-    PfixDictionary dictionary;
+    PfixEnvironment globals = std::make_shared<PfixScope>();
+    PfixEnvironment scope = globals;
 
+    // Whether modules loaded by scripts use the on-disk cache
+    bool use_module_cache = false;
+
+    // Called for a symbol that no scope binds, it may bind the symbol in
+    // globals and return true. Workers copy the globals of their parent this way.
+    std::function<bool(SymbolId)> bind_missing;
+
+    PfixProfiler profiler;
+
+    // Number of nested calls before evaluation fails, tail calls do not count.
+    // Calls are cheap but not free, running into the default limit takes
+    // about a second and 100 MB; lower it to fail runaway recursion sooner.
+    size_t max_depth = 1000000;
+
+    // Where print, println, stack, dict and profile reports write to
+    std::ostream* out = &std::cout;
+    std::ostream* err = &std::cerr;
+
+    // Bind the words of builtin_table that are not defined yet
     void load_builtins();
 
-    void push(std::unique_ptr<Obj> obj);
+    // Evaluate source code in the current scope. Errors are raised with
+    // the line and column they occurred at.
+    void eval(std::string_view source);
+
+    // Compiled code of the array. Compiled on first use and again once a word
+    // it compiled in place was redefined.
+    const std::shared_ptr<Code>& prepare(ExeArr* exe_arr);
+
+    // Push a frame for the body, it runs once control is back in the dispatch loop
+    void enter(std::shared_ptr<Code> code, PfixEnvironment env);
+    void enter(ExeArr* exe_arr);
+
+    // Run the array to completion
+    void call(ExeArr* exe_arr);
+
+    // Run the code to completion in the current scope, as the branches of if do
+    void run_block(std::shared_ptr<Code> code);
+
+    void push(Value obj);
+    void push_token(const Token& token);
     friend std::ostream& operator<<(std::ostream& os, PfixInterpreter& interp);
 };
 
@@ -0,0 +1,299 @@
+#include "jit.hpp"
+#include "compiler.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <sys/mman.h>
+
+JitFunction::JitFunction(const std::vector<uint8_t>& machine_code) {
+    size = machine_code.size();
+    memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) {
+        memory = nullptr;
+        return;
+    }
+
+    std::memcpy(memory, machine_code.data(), size);
+    if(mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) return;
+    entry = reinterpret_cast<Entry>(memory);
+}
+
+JitFunction::~JitFunction() {
+    if(memory != nullptr) munmap(memory, size);
+}
+
+#if defined(__x86_64__)
+
+static_assert(offsetof(JitContext, depth) == 0 && offsetof(JitContext, bailed) == 8, "Layout used by native code");
+
+namespace {
+
+// Baseline compiler to x86-64. The operand stack of the body is the native
+// stack, every value takes a quadword holding the :Int or a :Bool.
+//
+//   rbx  arguments of the call, also the frame slots of the parameters
+//   r12  JitContext
+//   rbp  frame, the operand stack starts at rbp - 16
+//
+// Calls to the function itself follow the entry convention, rdi points to
+// the arguments on the operand stack and rsi is the context.
+class Assembler {
+private:
+    const Code& code;
+    size_t num_params;
+    std::vector<uint8_t> out;
+
+    // Offset of every instruction, patched into jumps once known
+    std::vector<size_t> labels;
+    std::vector<std::pair<size_t, size_t>> jumps;
+    std::vector<size_t> bails;
+    size_t body = 0;
+
+    void emit(std::initializer_list<uint8_t> bytes) {
+        out.insert(out.end(), bytes);
+    }
+
+    void emit32(uint32_t x) {
+        for(int i = 0; i < 4; i++) out.push_back(uint8_t(x >> (8 * i)));
+    }
+
+    void emit64(uint64_t x) {
+        for(int i = 0; i < 8; i++) out.push_back(uint8_t(x >> (8 * i)));
+    }
+
+    void patch32(size_t at, size_t target) {
+        uint32_t rel = uint32_t(int64_t(target) - int64_t(at + 4));
+        std::memcpy(&out[at], &rel, 4);
+    }
+
+    void branch_to(std::initializer_list<uint8_t> opcode, size_t offset) {
+        emit(opcode);
+        emit32(0);
+        patch32(out.size() - 4, offset);
+    }
+
+    void jump_to(std::initializer_list<uint8_t> opcode, size_t pc) {
+        emit(opcode);
+        jumps.emplace_back(out.size(), pc);
+        emit32(0);
+    }
+
+    void bail_if(std::initializer_list<uint8_t> opcode) {
+        emit(opcode);
+        bails.push_back(out.size());
+        emit32(0);
+    }
+
+    uint32_t slot(uint32_t index) {
+        return 8 * (num_params - 1 - index);
+    }
+
+    void epilogue() {
+        emit({0x48, 0x8D, 0x65, 0xF0});     // lea rsp, [rbp - 16]
+        emit({0x41, 0x5C});                 // pop r12
+        emit({0x5B});                       // pop rbx
+        emit({0x5D});                       // pop rbp
+        emit({0xC3});                       // ret
+    }
+
+    // rax = rax op rcx, overflow leaves the call to the interpreter which promotes
+    bool arith(TypedOp op) {
+        switch(op) {
+            case TypedOp::ADD:
+                emit({0x48, 0x01, 0xC8});                           // add rax, rcx
+                bail_if({0x0F, 0x80});                              // jo bail
+                break;
+            case TypedOp::SUB:
+                emit({0x48, 0x29, 0xC8});                           // sub rax, rcx
+                bail_if({0x0F, 0x80});                              // jo bail
+                break;
+            case TypedOp::MUL:
+                emit({0x48, 0x0F, 0xAF, 0xC1});                     // imul rax, rcx
+                bail_if({0x0F, 0x80});                              // jo bail
+                break;
+            case TypedOp::DIV:
+            case TypedOp::MOD:
+                emit({0x48, 0x85, 0xC9});                           // test rcx, rcx
+                bail_if({0x0F, 0x84});                              // jz bail
+                emit({0x48, 0x83, 0xF9, 0xFF});                     // cmp rcx, -1
+                bail_if({0x0F, 0x84});                              // je bail
+                emit({0x48, 0x99});                                 // cqo
+                emit({0x48, 0xF7, 0xF9});                           // idiv rcx
+                if(op == TypedOp::MOD) emit({0x48, 0x89, 0xD0});    // mov rax, rdx
+                break;
+            default:
+                uint8_t setcc;
+                switch(op) {
+                    case TypedOp::LESS: setcc = 0x9C; break;
+                    case TypedOp::GREATER: setcc = 0x9F; break;
+                    case TypedOp::LESS_EQUAL: setcc = 0x9E; break;
+                    case TypedOp::GREATER_EQUAL: setcc = 0x9D; break;
+                    case TypedOp::EQUAL: setcc = 0x94; break;
+                    case TypedOp::NOT_EQUAL: setcc = 0x95; break;
+                    default: return false;
+                }
+                emit({0x48, 0x39, 0xC8});                           // cmp rax, rcx
+                emit({0x0F, setcc, 0xC0});                          // setcc al
+                emit({0x0F, 0xB6, 0xC0});                           // movzx eax, al
+        }
+        return true;
+    }
+
+    bool is_tail(size_t pc) {
+        auto& ins = code.instructions;
+        while(pc < ins.size() && ins[pc].op == OpCode::JUMP) pc = ins[pc].arg;
+        return pc >= ins.size();
+    }
+
+    bool call_self(size_t pc) {
+        if(is_tail(pc + 1)) {
+            // Replace the arguments and start over, like a tail call in the interpreter
+            for(uint32_t i = 0; i < num_params; i++) {
+                emit({0x48, 0x8B, 0x84, 0x24}); emit32(8 * i);      // mov rax, [rsp + 8i]
+                emit({0x48, 0x89, 0x83}); emit32(8 * i);            // mov [rbx + 8i], rax
+            }
+            emit({0x48, 0x8D, 0x65, 0xF0});                         // lea rsp, [rbp - 16]
+            branch_to({0xE9}, body);                                // jmp body
+            return true;
+        }
+
+        emit({0x48, 0x89, 0xE7});                                   // mov rdi, rsp
+        emit({0x4C, 0x89, 0xE6});                                   // mov rsi, r12
+        branch_to({0xE8}, 0);                                       // call entry
+        emit({0x41, 0x80, 0x7C, 0x24, 0x08, 0x00});                 // cmp byte [r12 + 8], 0
+        bail_if({0x0F, 0x85});                                      // jne bail
+        emit({0x48, 0x81, 0xC4}); emit32(8 * num_params);           // add rsp, 8n
+        emit({0x50});                                               // push rax
+        return true;
+    }
+
+    bool instruction(size_t pc) {
+        auto& ins = code.instructions[pc];
+        switch(ins.op) {
+            case OpCode::PUSH_CONST: {
+                auto& x = code.constants[ins.arg];
+                if(x.tag == TypeTag::BOOL) {
+                    emit({0x68}); emit32(x.b);                      // push imm32
+                } else if(x.tag != TypeTag::INT) {
+                    return false;
+                } else if(x.i == int32_t(x.i)) {
+                    emit({0x68}); emit32(uint32_t(x.i));            // push imm32
+                } else {
+                    emit({0x48, 0xB8}); emit64(x.i);                // mov rax, imm64
+                    emit({0x50});                                   // push rax
+                }
+                return true;
+            }
+            case OpCode::LOAD_LOCAL:
+                if(ins.arg >= num_params) return false;
+                emit({0xFF, 0xB3}); emit32(slot(ins.arg));          // push qword [rbx + slot]
+                return true;
+            case OpCode::STORE_LOCAL:
+                if(ins.arg >= num_params) return false;
+                emit({0x8F, 0x83}); emit32(slot(ins.arg));          // pop qword [rbx + slot]
+                return true;
+            case OpCode::JUMP:
+                jump_to({0xE9}, ins.arg);
+                return true;
+            case OpCode::JUMP_IF_FALSE:
+                emit({0x58});                                       // pop rax
+                emit({0x85, 0xC0});                                 // test eax, eax
+                jump_to({0x0F, 0x84}, ins.arg);                     // jz target
+                return true;
+            case OpCode::INT_OP:
+                emit({0x59});                                       // pop rcx
+                emit({0x58});                                       // pop rax
+                if(!arith(TypedOp(ins.arg))) return false;
+                emit({0x50});                                       // push rax
+                return true;
+            case OpCode::INT_CONST_OP: {
+                auto& x = code.constants[ins.arg >> 8];
+                if(x.tag != TypeTag::INT) return false;
+                emit({0x58});                                       // pop rax
+                if(x.i == int32_t(x.i)) {
+                    emit({0x48, 0xC7, 0xC1}); emit32(uint32_t(x.i));  // mov rcx, imm32
+                } else {
+                    emit({0x48, 0xB9}); emit64(x.i);                // mov rcx, imm64
+                }
+                if(!arith(TypedOp(ins.arg & 0xff))) return false;
+                emit({0x50});                                       // push rax
+                return true;
+            }
+            case OpCode::CALL:
+                return ins.arg == code.self && call_self(pc);
+            default:
+                return false;
+        }
+    }
+
+public:
+    Assembler(const Code& code) : code(code), num_params(code.num_locals) {}
+
+    bool assemble(std::vector<uint8_t>& machine_code) {
+        auto& ins = code.instructions;
+
+        // The prologue of the body stores the arguments, which already are in their slots
+        if(num_params == 0 || ins.size() < num_params) return false;
+        for(size_t i = 0; i < num_params; i++) {
+            if(ins[i].op != OpCode::STORE_LOCAL || ins[i].arg != num_params - 1 - i) return false;
+        }
+
+        emit({0x55});                                               // push rbp
+        emit({0x48, 0x89, 0xE5});                                   // mov rbp, rsp
+        emit({0x53});                                               // push rbx
+        emit({0x41, 0x54});                                         // push r12
+        emit({0x48, 0x89, 0xFB});                                   // mov rbx, rdi
+        emit({0x49, 0x89, 0xF4});                                   // mov r12, rsi
+        emit({0x49, 0xFF, 0x0C, 0x24});                             // dec qword [r12]
+        bail_if({0x0F, 0x88});                                      // js bail
+        body = out.size();
+
+        labels.assign(ins.size() + 1, 0);
+        for(size_t pc = num_params; pc < ins.size(); pc++) {
+            labels[pc] = out.size();
+            if(!instruction(pc)) return false;
+        }
+
+        labels[ins.size()] = out.size();
+        emit({0x58});                                               // pop rax
+        emit({0x49, 0xFF, 0x04, 0x24});                             // inc qword [r12]
+        epilogue();
+
+        size_t bail = out.size();
+        emit({0x41, 0xC6, 0x44, 0x24, 0x08, 0x01});                 // mov byte [r12 + 8], 1
+        epilogue();
+
+        for(auto& it : jumps) {
+            if(it.second < num_params) return false;
+            patch32(it.first, labels[it.second]);
+        }
+        for(auto at : bails) patch32(at, bail);
+
+        machine_code = std::move(out);
+        return true;
+    }
+};
+
+}
+
+std::shared_ptr<JitFunction> jit_compile(const Code& code, const std::vector<TypeTag>& guard) {
+    if(!code.has_signature || code.returns != std::vector<TypeTag>{TypeTag::INT}) return nullptr;
+    if(guard.size() != code.num_locals || guard.size() > JIT_MAX_PARAMS) return nullptr;
+    for(auto tag : guard) {
+        if(tag != TypeTag::INT) return nullptr;
+    }
+
+    std::vector<uint8_t> machine_code;
+    if(!Assembler(code).assemble(machine_code)) return nullptr;
+
+    auto function = std::make_shared<JitFunction>(machine_code);
+    return function->valid() ? function : nullptr;
+}
+
+#else
+
+std::shared_ptr<JitFunction> jit_compile(const Code& code, const std::vector<TypeTag>& guard) {
+    return nullptr;
+}
+
+#endif
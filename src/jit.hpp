@@ -0,0 +1,51 @@
+#ifndef __PFIX_JIT_HPP__
+#define __PFIX_JIT_HPP__
+
+#include "types.hpp"
+
+// Calls of a typed variant before it is compiled
+constexpr uint32_t JIT_THRESHOLD = 1000;
+
+// Nested native calls before the call is left to the interpreter,
+// the native stack is much smaller than the frames of the interpreter
+constexpr int64_t JIT_MAX_DEPTH = 10000;
+
+// Functions with more parameters are not compiled
+constexpr size_t JIT_MAX_PARAMS = 16;
+
+// Shared with native code. depth counts the nested calls that are left,
+// bailed is set once native code gives up and the call has to run in
+// the interpreter instead.
+struct JitContext {
+    int64_t depth;
+    uint8_t bailed;
+};
+
+// Executable copy of the machine code of a function.
+// args holds one integer per parameter, the first one at the highest index.
+class JitFunction {
+public:
+    using Entry = int64_t (*)(int64_t* args, JitContext* context);
+
+    JitFunction(const std::vector<uint8_t>& machine_code);
+    JitFunction(const JitFunction&) = delete;
+    ~JitFunction();
+
+    bool valid() const { return entry != nullptr; }
+
+    int64_t operator()(int64_t* args, JitContext* context) const {
+        return entry(args, context);
+    }
+
+private:
+    void* memory = nullptr;
+    size_t size = 0;
+    Entry entry = nullptr;
+};
+
+// Compile a typed variant with :Int parameters and result whose body only
+// uses integer arithmetic, comparisons, branches and calls to itself.
+// guard holds the parameter types. Returns nullptr for everything else.
+std::shared_ptr<JitFunction> jit_compile(const Code& code, const std::vector<TypeTag>& guard);
+
+#endif
@@ -1,9 +1,6 @@
 #include "lexer.hpp"
 
-Lexer::Lexer(std::string&& input) {
-    std::setlocale(LC_ALL, "");
-    this->input = converter.from_bytes(input);
-}
+#include <charconv>
 
 bool is_punct(char c) {
     switch(c) {
@@ -21,70 +18,86 @@ bool is_ignored(char c) {
     return c == ',' || c == '#';
 }
 
-bool Lexer::peek(wchar_t& c) {
-    if(pos >= input.size()) {
-        return false;
-    } else {
-        c = input[pos];
-        return true;
-    }
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
 }
 
-bool is_bool(std::string& s) {
+bool is_bool(std::string_view s) {
     return s == "true" || s == "false";
 }
 
-bool is_float(std::string& s) {
-    try {
-        std::stod(s);
-    } catch(...) {
-        return false;
-    }
-    return true;
+bool parse_integer(std::string_view s, int64_t& i, bool& big) {
+    auto first = s.data();
+    auto last = s.data() + s.size();
+    auto res = std::from_chars(first, last, i);
+    big = res.ec == std::errc::result_out_of_range;
+    return (res.ec == std::errc() || big) && res.ptr == last;
 }
 
-bool is_integer(std::string& s) {
-    return std::find_if(s.begin(), s.end(), [](char c) {
-        return !std::isdigit(c);
-    }) == s.end();
+bool parse_float(std::string_view s, double& f) {
+    auto first = s.data();
+    auto last = s.data() + s.size();
+    auto res = std::from_chars(first, last, f);
+    return res.ec == std::errc() && res.ptr == last;
 }
 
-TokenType Lexer::next(std::string& buffer) {
-    wchar_t c;
-    buffer.clear();
+// UTF-8 continuation bytes do not start a new column
+void Lexer::advance() {
+    char c = input[pos++];
+    if(c == '\n') {
+        line++;
+        column = 1;
+    } else if((c & 0xC0) != 0x80) {
+        column++;
+    }
+}
 
+TokenType Lexer::next(Token& token) {
     // Skip all the spaces
-    while(peek(c) && (std::iswspace(c) || is_ignored(c))) {
-        if(c == '#') {
-            while(peek(c) && c != '\n') pos++;
-        } else pos++;
+    while(pos < input.size() && (is_space(input[pos]) || is_ignored(input[pos]))) {
+        if(input[pos] == '#') {
+            while(pos < input.size() && input[pos] != '\n') advance();
+        } else advance();
+    }
+
+    token.offset = pos;
+    token.line = line;
+    token.column = column;
+
+    if(pos >= input.size()) {
+        token.text = std::string_view();
+        return token.type = TokenType::EOL;
     }
-    if(!peek(c)) return TokenType::EOL;
-    pos++;
+
+    char c = input[pos];
+    advance();
 
     if(c == '\"') {
-        while(peek(c) && c != '\"') {
-            buffer += converter.to_bytes(c);
-            pos++;
-        }
-        pos++;
-        return TokenType::STR;
-    } else if(is_punct(c)) {
-        buffer = converter.to_bytes(c);
-    } else {
-        buffer += converter.to_bytes(c);
-        while(peek(c) && !std::iswspace(c) && !is_punct(c) && !is_ignored(c)) {
-            buffer += converter.to_bytes(c);
-            pos++;
-        }
+        size_t start = pos;
+        while(pos < input.size() && input[pos] != '\"') advance();
+        token.text = input.substr(start, pos - start);
+        if(pos < input.size()) advance();
+        return token.type = TokenType::STR;
+    }
 
-        if(is_bool(buffer)) {
-            return TokenType::BOOL;
-        } else if(is_integer(buffer)) {
-            return TokenType::INT;
-        } else if(is_float(buffer)) {
-            return TokenType::FLT;
+    size_t start = pos - 1;
+    if(!is_punct(c)) {
+        while(pos < input.size() && !is_space(input[pos]) && !is_punct(input[pos]) && !is_ignored(input[pos])) {
+            advance();
         }
     }
-    return TokenType::SYM;
+    token.text = input.substr(start, pos - start);
+
+    if(is_bool(token.text)) {
+        token.b = token.text == "true";
+        return token.type = TokenType::BOOL;
+    }
+
+    bool big;
+    if(parse_integer(token.text, token.i, big)) {
+        return token.type = big ? TokenType::BIG_INT : TokenType::INT;
+    } else if(parse_float(token.text, token.f)) {
+        return token.type = TokenType::FLT;
+    }
+    return token.type = TokenType::SYM;
 }
@@ -1,32 +1,47 @@
 #ifndef __LEXER_HPP__
 #define __LEXER_HPP__
 
-#include <iostream>
-#include <string>
-#include <locale>
-#include <clocale>
-#include <codecvt>
-#include <algorithm>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
 
 enum class TokenType {
     STR,
     SYM,
     BOOL,
     INT,
+    BIG_INT,    // integer beyond 64 bits, parsed from text
     FLT,
     EOL // end of line
 };
 
+struct Token {
+    TokenType type;
+    std::string_view text;  // view into the input, strings without quotes
+    size_t offset;          // byte offset of the first character
+    unsigned line;
+    unsigned column;        // counted in code points, starting at 1
+
+    // Parsed literal values
+    bool b;
+    int64_t i;
+    double f;
+};
+
+// Splits UTF-8 input into tokens without copying it.
+// The input has to outlive the returned tokens.
 class Lexer {
 public:
-    unsigned int pos = 0;
-    std::wstring input;
-    std::locale loc;
-    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
-
-    Lexer(std::string&& input);
-    bool peek(wchar_t& c);
-    TokenType next(std::string& buffer);
+    size_t pos = 0;
+    unsigned line = 1;
+    unsigned column = 1;
+    std::string_view input;
+
+    Lexer(std::string_view input) : input(input) {}
+    TokenType next(Token& token);
+
+private:
+    void advance();
 };
 
 #endif
@@ -1,5 +1,9 @@
 #include <iostream>
+#include <fstream>
 #include <cstring>
+#include <cstdio>
+#include <clocale>
+#include <cstdlib>
 #include <readline/readline.h>
 #include <readline/history.h>
 
@@ -8,10 +12,11 @@
 
 #define VERSION "v0.2.0"
 
-#include "types.hpp"
 #include "interpreter.hpp"
+#include "module.hpp"
 
-PfixInterpreter* rl_interp;
+// Completion callbacks of readline take no context, there is one REPL per process
+static PfixInterpreter* rl_interp;
 
 char* builtin_name_generator(const char* text, int state) {
     static std::vector<std::string> matches;
@@ -21,11 +26,12 @@ char* builtin_name_generator(const char* text, int state) {
         matches.clear();
         match_index = 0;
 
-        for(auto it : rl_interp->dictionary) {
-            if(std::strncmp(it.first.c_str(), text, strlen(text)) == 0) {
-                matches.push_back(it.first);
+        rl_interp->globals->bindings.for_each([text](SymbolId id, const PfixDictionary::Binding&) {
+            auto& name = symbol_name(id);
+            if(std::strncmp(name.c_str(), text, strlen(text)) == 0) {
+                matches.push_back(name);
             }
-        }
+        });
     }
 
     if(match_index >= matches.size()) {
@@ -40,11 +46,151 @@ char** builtin_name_completion(const char* text, int start, int end) {
     return rl_completion_matches(text, builtin_name_generator);
 }
 
-int main() {
-    bool running = true;
-    auto interp = PfixInterpreter();
+void report_error(std::ostream& err, const char* path, const Token& token, const std::exception& e) {
+    err << path << ":" << token.line << ":" << token.column << ": Error: " << e.what() << std::endl;
+}
+
+// Compile the whole script, or load it from its cache, then run it
+int run_file(PfixInterpreter& interp, const char* path, bool use_cache) {
+    PfixModule module;
+    try {
+        run_module_file(interp, path, module, use_cache);
+    } catch(const PfixIOError& e) {
+        *interp.err << e.what() << std::endl;
+        return 2;
+    } catch(const std::exception& e) {
+        *interp.err << path << ":" << module.position.line << ":" << module.position.column
+            << ": Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Evaluate a stream in large chunks. A token touching the end of a chunk
+// may continue in the next one, so it is kept back until more input arrives.
+int run_stream(PfixInterpreter& interp, std::FILE* file, const char* path) {
+    constexpr size_t CHUNK_SIZE = 1 << 16;
+    std::vector<char> chunk(CHUNK_SIZE);
+    std::string pending;
+    unsigned line = 1;
+    unsigned column = 1;
+    bool eof = false;
+
+    Token token;
+    try {
+        while(!eof) {
+            size_t n = std::fread(chunk.data(), 1, chunk.size(), file);
+            eof = n < chunk.size();
+            pending.append(chunk.data(), n);
+
+            Lexer lexer(pending);
+            lexer.line = line;
+            lexer.column = column;
+
+            size_t consumed = 0;
+            while(lexer.next(token) != TokenType::EOL) {
+                if(!eof && lexer.pos >= pending.size()) break;
+                interp.push_token(token);
+                consumed = lexer.pos;
+                line = lexer.line;
+                column = lexer.column;
+            }
+            pending.erase(0, consumed);
+        }
+    } catch(const std::exception& e) {
+        report_error(*interp.err, path, token, e);
+        return 1;
+    }
+
+    if(std::ferror(file)) {
+        *interp.err << "Could not read " << path << std::endl;
+        return 2;
+    }
+    return 0;
+}
+
+void usage() {
+    std::cerr << "Usage: pfix [--cache] [--profile] [--profile-folded file] [--max-depth n] [script.pf | -] [args...]" << std::endl;
+}
+
+int repl(PfixInterpreter& interp);
+
+int main(int argc, char** argv) {
+    std::setlocale(LC_ALL, "");
+
+    PfixInterpreter interp;
     interp.load_builtins();
 
+    int arg_index = 1;
+    bool use_cache = false;
+    bool profile = false;
+    const char* folded_path = nullptr;
+    for(; arg_index < argc && std::strncmp(argv[arg_index], "--", 2) == 0; arg_index++) {
+        if(std::strcmp(argv[arg_index], "--cache") == 0) {
+            use_cache = true;
+        } else if(std::strcmp(argv[arg_index], "--profile") == 0) {
+            profile = true;
+        } else if(std::strcmp(argv[arg_index], "--profile-folded") == 0 && arg_index + 1 < argc) {
+            profile = true;
+            folded_path = argv[++arg_index];
+        } else if(std::strcmp(argv[arg_index], "--max-depth") == 0 && arg_index + 1 < argc) {
+            char* end;
+            interp.max_depth = std::strtoul(argv[++arg_index], &end, 10);
+            if(*end != '\0' || interp.max_depth == 0) {
+                usage();
+                return 2;
+            }
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    interp.use_module_cache = use_cache;
+    interp.profiler.enabled = profile;
+
+    // Script mode, remaining arguments are available as args
+    if(arg_index < argc) {
+        const char* path = argv[arg_index];
+        if(path[0] == '-' && path[1] != '\0') {
+            usage();
+            return 2;
+        }
+
+        std::vector<Value> args;
+        for(int i = arg_index + 1; i < argc; i++) {
+            args.push_back(std::make_unique<Str>(argv[i]));
+        }
+        interp.globals->bindings["args"] = std::make_unique<Arr>(std::move(args));
+
+        std::ios::sync_with_stdio(false);
+        int status = std::strcmp(path, "-") == 0
+            ? run_stream(interp, stdin, "<stdin>")
+            : run_file(interp, path, use_cache);
+        std::cout.flush();
+
+        if(profile) {
+            interp.profiler.report(*interp.err);
+        }
+        if(folded_path != nullptr) {
+            std::ofstream file(folded_path);
+            interp.profiler.write_folded(file);
+            if(!file) {
+                std::cerr << "Could not write " << folded_path << std::endl;
+                status = 2;
+            }
+        }
+        return status;
+    } else if(use_cache || profile) {
+        usage();
+        return 2;
+    }
+
+    return repl(interp);
+}
+
+int repl(PfixInterpreter& interp) {
+    bool running = true;
+
     rl_interp = &interp;
     rl_attempted_completion_function = builtin_name_completion;
 
@@ -64,29 +210,11 @@ int main() {
         if(input.size() > 0) add_history(input.c_str());
 
         // Split into tokens
-        Lexer lexer(std::move(input));
-        TokenType tok;
-        std::string token;
+        Lexer lexer(input);
+        Token token;
         try {
-            while((tok = lexer.next(token)) != TokenType::EOL) {
-                switch(tok) {
-                    case TokenType::STR:
-                        interp.push(std::make_unique<Str>(token));
-                        break;
-                    case TokenType::BOOL:
-                        interp.push(std::make_unique<Bool>(token == "true"));
-                        break;
-                    case TokenType::INT:
-                        interp.push(std::make_unique<Int>(std::stoi(token)));
-                        break;
-                    case TokenType::FLT:
-                        interp.push(std::make_unique<Flt>(std::stod(token)));
-                        break;
-                    case TokenType::SYM:
-                        interp.push(std::make_unique<Sym>(token));
-                        break;
-                    case TokenType::EOL: break;
-                }
+            while(lexer.next(token) != TokenType::EOL) {
+                interp.push_token(token);
             }
     
             if(interp.stack.size() <= last) {
@@ -96,26 +224,26 @@ int main() {
                 continue;
             }
             
-            if(interp.stack.size() > 0 && interp.stack.back()->tag == TypeTag::SYM) {
-                auto obj = dynamic_cast<Sym*>(interp.stack.back().get());
-                if(obj->str == "{") {
+            if(interp.stack.size() > 0 && interp.stack.back().tag == TypeTag::SYM) {
+                auto sym = interp.stack.back().as<Sym>()->str();
+                if(sym == "{") {
                     prompt = "... ";
                     last = interp.stack.size();
                     exe_arr = true;
                 }
 
-                sanitize_symbol(obj->str);
-                if(obj->str == "exit") {
+                sanitize_symbol(sym);
+                if(sym == "exit") {
                     running = false;
                 }
             }
 
         } catch(const std::runtime_error& e) {
-            std::cerr << "Error: " << e.what() << std::endl;
+            *interp.err << "Error: " << e.what() << std::endl;
         }
 
         if(interp.stack.size() > 0 && !exe_arr) {
-            interp.stack.back()->print(std::cout) << std::endl;
+            interp.stack.back().print(*interp.out) << std::endl;
         }
     }
 
@@ -0,0 +1,418 @@
+#include "module.hpp"
+#include "interpreter.hpp"
+#include "bigint.hpp"
+
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+MappedFile::~MappedFile() {
+    if(data != nullptr) munmap(const_cast<char*>(data), size);
+}
+
+bool MappedFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+
+    size = st.st_size;
+    if(size > 0) {
+        void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(ptr == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(ptr, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(ptr);
+    }
+    close(fd);
+    return true;
+}
+
+// FNV-1a
+uint64_t content_hash(std::string_view data) {
+    uint64_t hash = 14695981039346656037ull;
+    for(unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void PfixModule::compile(std::string_view source, PfixScope& scope) {
+    const SymbolId lbrace = intern("{");
+    const SymbolId rbrace = intern("}");
+    const SymbolId lparen = intern("(");
+    const SymbolId rparen = intern(")");
+
+    Lexer lexer(source);
+    Token token;
+    std::vector<Value> group;
+    SourcePosition start;
+    int depth = 0;
+    bool in_params = false;
+
+    while(lexer.next(token) != TokenType::EOL) {
+        position = {token.line, token.column};
+        auto value = token_value(token);
+        SymbolId id = value.tag == TypeTag::SYM ? value.as<Sym>()->id : UINT32_MAX;
+
+        if(depth > 0) {
+            if(id == lbrace) depth++;
+            if(id == rbrace && --depth == 0) {
+                auto exe_arr = std::make_unique<ExeArr>(std::move(group));
+                exe_arr->code = ::compile(exe_arr->vec, scope);
+                items.push_back(std::move(exe_arr));
+                positions.push_back(start);
+                group = std::vector<Value>();
+                continue;
+            }
+            group.push_back(std::move(value));
+        } else if(in_params) {
+            group.push_back(std::move(value));
+            if(id == rparen) {
+                PfixStack tmp;
+                std::move(group.begin(), group.end() - 1, std::back_inserter(tmp));
+                param_list_close(&tmp);
+                items.push_back(tmp.pop());
+                positions.push_back(start);
+                group.clear();
+                in_params = false;
+            }
+        } else if(id == lbrace) {
+            depth = 1;
+            start = position;
+        } else if(id == lparen) {
+            in_params = true;
+            start = position;
+            group.push_back(std::move(value));
+        } else if(id == rbrace) {
+            throw std::runtime_error("Closing executable array without beginning");
+        } else {
+            items.push_back(std::move(value));
+            positions.push_back(position);
+        }
+    }
+
+    if(depth > 0) {
+        position = start;
+        throw std::runtime_error("Executable array without closing '}'");
+    } else if(in_params) {
+        position = start;
+        throw std::runtime_error("Parameter list without closing ')'");
+    }
+}
+
+void PfixModule::run(PfixInterpreter& interp) {
+    for(size_t i = 0; i < items.size(); i++) {
+        position = positions[i];
+        interp.push(std::move(items[i]));
+    }
+    items.clear();
+    positions.clear();
+}
+
+namespace {
+
+const char CACHE_MAGIC[4] = {'P', 'F', 'X', 'C'};
+constexpr uint32_t CACHE_VERSION = 3;
+
+class CacheWriter {
+public:
+    std::string out;
+    std::vector<SymbolId> symbols;
+    std::unordered_map<SymbolId, uint32_t> symbol_index;
+
+    template<typename T>
+    void put(T x) {
+        out.append(reinterpret_cast<const char*>(&x), sizeof(T));
+    }
+
+    void put_string(const std::string& str) {
+        put<uint32_t>(str.size());
+        out.append(str);
+    }
+
+    uint32_t symbol(SymbolId id) {
+        auto iter = symbol_index.find(id);
+        if(iter != symbol_index.end()) return iter->second;
+        symbols.push_back(id);
+        symbol_index.emplace(id, symbols.size() - 1);
+        return symbols.size() - 1;
+    }
+
+    void value(const Value& v) {
+        put<uint8_t>(static_cast<uint8_t>(v.tag));
+        switch(v.tag) {
+            case TypeTag::BOOL: put<uint8_t>(v.b); break;
+            case TypeTag::INT: put<int64_t>(v.i); break;
+            case TypeTag::BIG_INT: put_string(v.as<BigInt>()->to_string()); break;
+            case TypeTag::FLT: put<double>(v.f); break;
+            case TypeTag::STR: put_string(v.as<Str>()->str); break;
+            case TypeTag::SYM: put<uint32_t>(symbol(v.as<Sym>()->id)); break;
+            case TypeTag::PARAMS: {
+                auto params = v.as<Params>();
+                put<uint32_t>(params->params.size());
+                for(auto& it : params->params) {
+                    put_string(it.first);
+                    put_string(it.second);
+                }
+                put<uint32_t>(params->ret_types.size());
+                for(auto& it : params->ret_types) put_string(it);
+                break;
+            }
+            case TypeTag::EXE_ARR: {
+                auto exe_arr = v.as<ExeArr>();
+                put<uint32_t>(exe_arr->vec.size());
+                for(auto& x : exe_arr->vec) value(x);
+                code(*exe_arr->code);
+                break;
+            }
+            default:
+                throw std::runtime_error("Cannot cache values of type " + type_to_string(v.tag));
+        }
+    }
+
+    // The baseline is stored, the optimizer runs again when it is loaded
+    void code(const Code& code) {
+        auto& instructions = code.baseline.empty() ? code.instructions : code.baseline;
+        put<uint32_t>(instructions.size());
+        for(auto& ins : instructions) {
+            put<uint8_t>(static_cast<uint8_t>(ins.op));
+            put<uint32_t>(has_symbol_arg(ins.op) ? symbol(ins.arg) : ins.arg);
+        }
+        put<uint32_t>(code.constants.size());
+        for(auto& x : code.constants) value(x);
+        put<uint32_t>(code.num_locals);
+        put<uint8_t>(code.needs_scope);
+        put<uint32_t>(code.inlined.size());
+        for(auto id : code.inlined) put<uint32_t>(symbol(id));
+    }
+};
+
+class CacheReader {
+public:
+    const char* pos;
+    const char* end;
+    PfixScope& scope;
+    std::vector<SymbolId> symbols;
+
+    CacheReader(std::string_view data, PfixScope& scope)
+        : pos(data.data()), end(data.data() + data.size()), scope(scope) {}
+
+    template<typename T>
+    T get() {
+        if(static_cast<size_t>(end - pos) < sizeof(T)) throw std::runtime_error("Truncated cache");
+        T x;
+        std::memcpy(&x, pos, sizeof(T));
+        pos += sizeof(T);
+        return x;
+    }
+
+    // Number of elements that take at least size bytes each
+    size_t count(size_t size) {
+        auto n = get<uint32_t>();
+        if(n > static_cast<size_t>(end - pos) / size) throw std::runtime_error("Truncated cache");
+        return n;
+    }
+
+    std::string get_string() {
+        auto size = get<uint32_t>();
+        if(static_cast<size_t>(end - pos) < size) throw std::runtime_error("Truncated cache");
+        std::string str(pos, size);
+        pos += size;
+        return str;
+    }
+
+    SymbolId symbol(uint32_t index) {
+        if(index >= symbols.size()) throw std::runtime_error("Invalid symbol in cache");
+        return symbols[index];
+    }
+
+    Value value() {
+        auto tag = static_cast<TypeTag>(get<uint8_t>());
+        switch(tag) {
+            case TypeTag::BOOL: return Value(get<uint8_t>() != 0);
+            case TypeTag::INT: return Value(get<int64_t>());
+            case TypeTag::BIG_INT: {
+                auto digits = get_string();
+                size_t sign = !digits.empty() && digits[0] == '-';
+                if(digits.size() == sign || digits.find_first_not_of("0123456789", sign) != std::string::npos) {
+                    throw std::runtime_error("Invalid value in cache");
+                }
+                return parse_big_integer(digits);
+            }
+            case TypeTag::FLT: return Value(get<double>());
+            case TypeTag::STR: return std::make_unique<Str>(get_string());
+            case TypeTag::SYM: return std::make_unique<Sym>(symbol(get<uint32_t>()));
+            case TypeTag::PARAMS: {
+                Params::Parameters params(count(8));
+                for(auto& it : params) {
+                    it.first = get_string();
+                    it.second = get_string();
+                }
+                Params::ReturnTypes ret_types(count(4));
+                for(auto& it : ret_types) it = get_string();
+                return std::make_unique<Params>(std::move(params), std::move(ret_types));
+            }
+            case TypeTag::EXE_ARR: {
+                std::vector<Value> vec(count(1));
+                for(auto& x : vec) x = value();
+                auto exe_arr = std::make_unique<ExeArr>(std::move(vec));
+                exe_arr->code = code();
+                return exe_arr;
+            }
+            default:
+                throw std::runtime_error("Invalid value in cache");
+        }
+    }
+
+    // Only baseline instructions are stored, their arguments are checked
+    // against the constants, slots and length of the code
+    std::shared_ptr<Code> code() {
+        auto code = std::make_shared<Code>();
+        code->instructions.resize(count(5));
+        for(auto& ins : code->instructions) {
+            ins.op = static_cast<OpCode>(get<uint8_t>());
+            ins.arg = get<uint32_t>();
+            if(ins.op > OpCode::JUMP_IF_FALSE) throw std::runtime_error("Invalid instruction in cache");
+            if(has_symbol_arg(ins.op)) ins.arg = symbol(ins.arg);
+        }
+        code->caches.resize(code->instructions.size());
+        code->constants.resize(count(1));
+        for(auto& x : code->constants) x = value();
+        code->num_locals = get<uint32_t>();
+        code->needs_scope = get<uint8_t>() != 0;
+        code->inlined.resize(count(4));
+        for(auto& id : code->inlined) {
+            id = symbol(get<uint32_t>());
+            auto binding = scope.lookup(id);
+            if(binding == nullptr || binding->tag != TypeTag::NATIVE_SYM) {
+                throw std::runtime_error("Cache compiled in place a word that was redefined");
+            }
+            PfixDictionary::watch(id);
+        }
+
+        // Every slot is stored by at least one instruction
+        if(code->num_locals > code->instructions.size()) throw std::runtime_error("Invalid code in cache");
+        for(auto& ins : code->instructions) {
+            size_t limit = 0;
+            switch(ins.op) {
+                case OpCode::PUSH_CONST: limit = code->constants.size(); break;
+                case OpCode::LOAD_LOCAL:
+                case OpCode::STORE_LOCAL: limit = code->num_locals; break;
+                case OpCode::JUMP:
+                case OpCode::JUMP_IF_FALSE: limit = code->instructions.size() + 1; break;
+                default: continue;
+            }
+            if(ins.arg >= limit) throw std::runtime_error("Invalid code in cache");
+        }
+
+        optimize(*code, scope);
+        return code;
+    }
+};
+
+}
+
+// Layout: magic, version, source hash, checksum of the rest, symbol names, items with positions
+bool PfixModule::save_cache(const std::string& path, uint64_t hash) const {
+    CacheWriter body;
+    try {
+        body.put<uint32_t>(items.size());
+        for(size_t i = 0; i < items.size(); i++) {
+            body.value(items[i]);
+            body.put<uint32_t>(positions[i].line);
+            body.put<uint32_t>(positions[i].column);
+        }
+    } catch(const std::runtime_error&) {
+        return false;
+    }
+
+    CacheWriter header;
+    header.out.append(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.put<uint32_t>(CACHE_VERSION);
+    header.put<uint64_t>(hash);
+
+    CacheWriter names;
+    names.put<uint32_t>(body.symbols.size());
+    for(auto id : body.symbols) names.put_string(symbol_name(id));
+    header.put<uint64_t>(content_hash(names.out + body.out));
+    header.out += names.out;
+
+    // Write to a temporary file first so readers never see a partial cache
+    auto tmp_path = path + ".tmp";
+    std::FILE* file = std::fopen(tmp_path.c_str(), "wb");
+    if(file == nullptr) return false;
+    bool ok = std::fwrite(header.out.data(), 1, header.out.size(), file) == header.out.size()
+        && std::fwrite(body.out.data(), 1, body.out.size(), file) == body.out.size();
+    ok = std::fclose(file) == 0 && ok;
+
+    if(!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool PfixModule::load_cache(const std::string& path, uint64_t hash, PfixScope& scope) {
+    MappedFile file;
+    if(!file.open(path)) return false;
+
+    try {
+        CacheReader reader(file.view(), scope);
+        char magic[sizeof(CACHE_MAGIC)];
+        for(auto& c : magic) c = reader.get<char>();
+        if(std::memcmp(magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0) return false;
+        if(reader.get<uint32_t>() != CACHE_VERSION) return false;
+        if(reader.get<uint64_t>() != hash) return false;
+        auto checksum = reader.get<uint64_t>();
+        if(content_hash(std::string_view(reader.pos, reader.end - reader.pos)) != checksum) return false;
+
+        reader.symbols.resize(reader.count(4));
+        for(auto& id : reader.symbols) id = intern(reader.get_string());
+
+        std::vector<Value> loaded(reader.count(9));
+        std::vector<SourcePosition> loaded_positions(loaded.size());
+        for(size_t i = 0; i < loaded.size(); i++) {
+            loaded[i] = reader.value();
+            loaded_positions[i].line = reader.get<uint32_t>();
+            loaded_positions[i].column = reader.get<uint32_t>();
+        }
+
+        items = std::move(loaded);
+        positions = std::move(loaded_positions);
+        return true;
+    } catch(const std::exception&) {
+        return false;
+    }
+}
+
+void run_module_file(PfixInterpreter& interp, const std::string& path, PfixModule& module, bool use_cache) {
+    MappedFile source;
+    if(!source.open(path)) {
+        throw PfixIOError("Could not open " + path + ": " + std::strerror(errno));
+    }
+
+    if(use_cache) {
+        auto hash = content_hash(source.view());
+        auto cache_path = path + "c";
+        if(!module.load_cache(cache_path, hash, *interp.scope)) {
+            module.compile(source.view(), *interp.scope);
+            module.save_cache(cache_path, hash);
+        }
+    } else {
+        module.compile(source.view(), *interp.scope);
+    }
+
+    module.run(interp);
+}
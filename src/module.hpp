@@ -0,0 +1,60 @@
+#ifndef __PFIX_MODULE_HPP__
+#define __PFIX_MODULE_HPP__
+
+#include "types.hpp"
+
+#include <string_view>
+
+class PfixInterpreter;
+
+struct SourcePosition {
+    uint32_t line = 0;
+    uint32_t column = 0;
+};
+
+// Read only memory mapping of a whole file
+class MappedFile {
+public:
+    const char* data = nullptr;
+    size_t size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool open(const std::string& path);
+    std::string_view view() const { return std::string_view(data, size); }
+};
+
+// Raised when a module file or its cache cannot be accessed
+class PfixIOError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// A script compiled ahead of evaluation.
+// Top level executable arrays are compiled and parameter lists parsed,
+// every other token becomes an item that is pushed when the module runs.
+class PfixModule {
+public:
+    std::vector<Value> items;
+    std::vector<SourcePosition> positions;
+
+    // Position of the item being compiled or run, for error messages
+    SourcePosition position;
+
+    void compile(std::string_view source, PfixScope& scope);
+    void run(PfixInterpreter& interp);
+
+    // Versioned binary cache, valid only for sources with the same hash
+    bool load_cache(const std::string& path, uint64_t hash, PfixScope& scope);
+    bool save_cache(const std::string& path, uint64_t hash) const;
+};
+
+uint64_t content_hash(std::string_view data);
+
+// Compile the file at path, or load it from its cache next to it, and run it
+void run_module_file(PfixInterpreter& interp, const std::string& path, PfixModule& module, bool use_cache);
+
+#endif
@@ -0,0 +1,194 @@
+#include "parallel.hpp"
+#include "threads.hpp"
+
+PfixWorker::Parent::Parent(PfixInterpreter& interp)
+    : interp(&interp),
+    definitions(PfixDictionary::definitions),
+    versions(PfixDictionary::all_versions()) {}
+
+PfixWorker::PfixWorker(const Parent& parent) : parent(parent) {
+    interp.max_depth = parent.interp->max_depth;
+    interp.use_module_cache = parent.interp->use_module_cache;
+    interp.out = &out;
+    interp.err = &err;
+    interp.load_builtins();
+
+    // Builtins the parent redefined are replaced up front, other globals
+    // are copied when they are first resolved
+    scopes[parent.interp->globals.get()] = interp.globals;
+    parent.interp->globals->bindings.for_each([this](SymbolId id, const Value& x) {
+        if(x.tag == TypeTag::NATIVE_SYM || interp.globals->bindings.find(id) == nullptr) return;
+        interp.globals->bindings[id] = copy_value(x);
+    });
+    interp.scope = copy_scope(parent.interp->scope);
+    interp.bind_missing = [this](SymbolId id) { return import(id); };
+    settle();
+}
+
+// Closures stored in the scopes they capture keep each other alive
+PfixWorker::~PfixWorker() {
+    for(auto& it : scopes) it.second->bindings = PfixDictionary(it.second->parent != nullptr);
+}
+
+Value PfixWorker::copy(const Value& x) {
+    auto result = copy_value(x);
+    settle();
+    return result;
+}
+
+// Bindings stored while copying gave watched symbols new versions. The
+// copied code was valid for the parent, which has the same bindings.
+void PfixWorker::settle() {
+    for(auto code : copied) {
+        for(auto id : code->assumptions) PfixDictionary::watch(id);
+    }
+    for(auto code : copied) code->definitions = PfixDictionary::definitions;
+    copied.clear();
+}
+
+// Copy a global of the parent. The binding is new to the worker, but code
+// copied before was compiled with it and stays valid.
+bool PfixWorker::import(SymbolId id) {
+    auto x = parent.interp->globals->bindings.find(id);
+    if(x == nullptr) return false;
+
+    uint32_t definitions = PfixDictionary::definitions;
+    interp.globals->bindings[id] = copy_value(*x);
+    for(auto& it : codes) {
+        if(it.second->definitions == definitions) it.second->definitions = PfixDictionary::definitions;
+    }
+    settle();
+    return true;
+}
+
+Value PfixWorker::copy_value(const Value& x) {
+    switch(x.tag) {
+        case TypeTag::ARR: {
+            std::deque<Value> vec;
+            for(auto& y : x.as<Arr>()->vec) vec.push_back(copy_value(y));
+            return std::make_unique<Arr>(std::move(vec));
+        }
+        case TypeTag::EXE_ARR: {
+            auto exe_arr = x.as<ExeArr>();
+            std::deque<Value> vec;
+            for(auto& y : exe_arr->vec) vec.push_back(copy_value(y));
+            auto result = std::make_unique<ExeArr>(std::move(vec), copy_scope(exe_arr->env));
+            result->code = copy_code(exe_arr->code);
+            return result;
+        }
+        default:
+            // Objects of the parent are shared by its values, their counts are not touched
+            if(x.is_immediate() || x.obj == nullptr) return x;
+            return x.obj->copy();
+    }
+}
+
+PfixEnvironment PfixWorker::copy_scope(const PfixEnvironment& env) {
+    if(!env) return nullptr;
+    auto iter = scopes.find(env.get());
+    if(iter != scopes.end()) return iter->second;
+
+    // Known before the bindings are copied, they may refer to the scope
+    auto scope = std::make_shared<PfixScope>(copy_scope(env->parent));
+    scopes[env.get()] = scope;
+    env->bindings.for_each([this, &scope](SymbolId id, const Value& x) {
+        scope->bindings[id] = copy_value(x);
+    });
+    return scope;
+}
+
+// Code::assumptions_hold with the counters of the parent thread
+bool PfixWorker::assumptions_held(const Code& code) const {
+    if(code.definitions == parent.definitions) return true;
+    for(auto id : code.assumptions) {
+        if(parent.versions.get(id) > code.definitions) return false;
+    }
+    return true;
+}
+
+// Inline caches start out empty and invalid code continues in its baseline,
+// as it would in the parent
+std::shared_ptr<Code> PfixWorker::copy_code(const std::shared_ptr<Code>& code) {
+    if(!code) return nullptr;
+    auto iter = codes.find(code.get());
+    if(iter != codes.end()) return iter->second;
+
+    auto result = std::make_shared<Code>();
+    codes[code.get()] = result;
+    copied.push_back(result.get());
+
+    if(assumptions_held(*code)) {
+        result->instructions = code->instructions;
+        result->baseline = code->baseline;
+        result->baseline_pc = code->baseline_pc;
+        result->assumptions = code->assumptions;
+        result->typed = copy_code(code->typed);
+        result->guard = code->guard;
+    } else {
+        result->instructions = code->baseline;
+    }
+    result->caches.resize(result->instructions.size());
+    for(auto& x : code->constants) result->constants.push_back(copy_value(x));
+    result->num_locals = code->num_locals;
+    result->needs_scope = code->needs_scope;
+    result->has_signature = code->has_signature;
+    result->returns = code->returns;
+    result->self = code->self;
+#ifdef PFIX_JIT
+    result->calls = code->calls;
+    result->native = code->native;
+#endif
+    return result;
+}
+
+void expect_transferable(const Value& x, const char* word) {
+    switch(x.tag) {
+        case TypeTag::ARR:
+            for(auto& y : x.as<Arr>()->vec) expect_transferable(y, word);
+            break;
+        case TypeTag::EXE_ARR:
+            throw std::runtime_error(std::string(word) + " cannot return " + type_to_string(x.tag) + " from another thread");
+        default:
+            break;
+    }
+}
+
+size_t num_chunks(size_t n) {
+    return std::min(n, PfixThreadPool::shared().size() * CHUNKS_PER_THREAD);
+}
+
+void run_chunks(PfixInterpreter& interp, size_t n,
+    const std::function<void(PfixWorker&, size_t, size_t, size_t)>& body) {
+
+    size_t chunks = num_chunks(n);
+    PfixWorker::Parent parent(interp);
+    std::vector<std::pair<std::string, std::string>> output(chunks);
+
+    std::vector<PfixThreadPool::Task> tasks;
+    for(size_t i = 0; i < chunks; i++) {
+        tasks.push_back([&, i]() {
+            PfixWorker worker(parent);
+            try {
+                body(worker, i, n * i / chunks, n * (i + 1) / chunks);
+            } catch(...) {
+                output[i] = {worker.out.str(), worker.err.str()};
+                throw;
+            }
+            output[i] = {worker.out.str(), worker.err.str()};
+        });
+    }
+
+    auto write_output = [&]() {
+        for(auto& it : output) {
+            *interp.out << it.first;
+            *interp.err << it.second;
+        }
+    };
+    try {
+        PfixThreadPool::shared().run(tasks);
+    } catch(...) {
+        write_output();
+        throw;
+    }
+    write_output();
+}
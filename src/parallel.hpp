@@ -0,0 +1,72 @@
+#ifndef __PFIX_PARALLEL_HPP__
+#define __PFIX_PARALLEL_HPP__
+
+#include "interpreter.hpp"
+
+#include <functional>
+#include <sstream>
+#include <unordered_map>
+
+// Chunks an array is split into per thread of the pool
+constexpr size_t CHUNKS_PER_THREAD = 4;
+
+// Interpreter for one task on a thread of the pool, with its own copies of
+// the bindings and functions the parent interpreter can reach. Globals are
+// copied once the task first resolves them. Nothing is shared with the
+// parent, which waits while its workers run. Output is collected until the
+// parent writes it.
+// Created and destroyed on the thread of the task.
+class PfixWorker {
+public:
+    // State of the parent, taken on its thread before the tasks start
+    struct Parent {
+        PfixInterpreter* interp;
+        uint32_t definitions;
+        PfixDictionary::Counts versions;
+
+        explicit Parent(PfixInterpreter& interp);
+    };
+
+    PfixInterpreter interp;
+    std::ostringstream out;
+    std::ostringstream err;
+
+    explicit PfixWorker(const Parent& parent);
+    ~PfixWorker();
+
+    // Copy of a value of the parent. Functions run in copies of their scopes.
+    Value copy(const Value& x);
+
+private:
+    const Parent& parent;
+    std::unordered_map<const PfixScope*, PfixEnvironment> scopes;
+    std::unordered_map<const Code*, std::shared_ptr<Code>> codes;
+
+    // Code copied since the last call of settle
+    std::vector<Code*> copied;
+
+    void settle();
+    bool import(SymbolId id);
+    Value copy_value(const Value& x);
+    PfixEnvironment copy_scope(const PfixEnvironment& env);
+    std::shared_ptr<Code> copy_code(const std::shared_ptr<Code>& code);
+    bool assumptions_held(const Code& code) const;
+};
+
+// Whether a result of a worker can be moved to the parent. Executable
+// arrays, also inside arrays, refer to the code and scopes of the worker
+// and are rejected. Natives are not: they get their interpreter from the
+// stack they run on and libraries are never unloaded. Packed arrays only
+// hold numbers.
+void expect_transferable(const Value& x, const char* word);
+
+// Number of chunks run_chunks splits n elements into
+size_t num_chunks(size_t n);
+
+// Run body(worker, chunk, begin, end) for consecutive chunks of [0, n) on
+// the shared pool, each chunk in its own worker of interp. Once all are
+// done, their output is written to interp in the order of the chunks.
+void run_chunks(PfixInterpreter& interp, size_t n,
+    const std::function<void(PfixWorker&, size_t, size_t, size_t)>& body);
+
+#endif
@@ -0,0 +1,84 @@
+#include "profiler.hpp"
+
+#include <chrono>
+#include <iomanip>
+
+static uint64_t now_ns() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void PfixProfiler::enter(SymbolId id) {
+    size_t parent = calls.empty() ? 0 : calls.back().node;
+    auto iter = nodes[parent].children.find(id);
+    size_t node;
+    if(iter != nodes[parent].children.end()) {
+        node = iter->second;
+    } else {
+        node = nodes.size();
+        nodes[parent].children.emplace(id, node);
+        nodes.push_back(PathNode{id, parent});
+    }
+
+    auto& stats = words[id];
+    stats.calls++;
+    stats.active++;
+    calls.push_back({node, now_ns(), 0});
+}
+
+void PfixProfiler::leave() {
+    if(calls.empty()) return;
+
+    auto call = calls.back();
+    calls.pop_back();
+
+    uint64_t total = now_ns() - call.start;
+    uint64_t self = total > call.children_ns ? total - call.children_ns : 0;
+    if(!calls.empty()) calls.back().children_ns += total;
+
+    auto& node = nodes[call.node];
+    node.self_ns += self;
+
+    auto& stats = words[node.id];
+    stats.self_ns += self;
+    if(--stats.active == 0) stats.inclusive_ns += total;
+}
+
+void PfixProfiler::report(std::ostream& os) const {
+    std::vector<std::pair<SymbolId, WordStats>> sorted(words.begin(), words.end());
+    std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) {
+        return a.second.self_ns > b.second.self_ns;
+    });
+
+    auto flags = os.flags();
+    os << std::left << std::setw(24) << "word"
+        << std::right << std::setw(12) << "calls"
+        << std::setw(14) << "self ms"
+        << std::setw(14) << "inclusive ms" << std::endl;
+
+    os << std::fixed << std::setprecision(3);
+    for(auto& it : sorted) {
+        os << std::left << std::setw(24) << symbol_name(it.first)
+            << std::right << std::setw(12) << it.second.calls
+            << std::setw(14) << it.second.self_ns / 1e6
+            << std::setw(14) << it.second.inclusive_ns / 1e6 << std::endl;
+    }
+    os.flags(flags);
+}
+
+void PfixProfiler::write_folded(std::ostream& os) const {
+    std::vector<SymbolId> path;
+    for(size_t i = 1; i < nodes.size(); i++) {
+        uint64_t micros = nodes[i].self_ns / 1000;
+        if(micros == 0) continue;
+
+        path.clear();
+        for(size_t node = i; node != 0; node = nodes[node].parent) path.push_back(nodes[node].id);
+
+        for(auto it = path.rbegin(); it != path.rend(); it++) {
+            if(it != path.rbegin()) os << ";";
+            os << symbol_name(*it);
+        }
+        os << " " << micros << "\n";
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef __PFIX_PROFILER_HPP__
+#define __PFIX_PROFILER_HPP__
+
+#include "types.hpp"
+
+#include <unordered_map>
+
+// Records call counts and self and inclusive time per word.
+// Calls are tracked in a tree of call paths, which is exported as
+// folded stacks for flame graphs.
+class PfixProfiler {
+public:
+    // Checked once per call by the interpreter, nothing is recorded while false
+    bool enabled = false;
+
+    void enter(SymbolId id);
+    void leave();
+
+    // Words sorted by self time
+    void report(std::ostream& os) const;
+
+    // One line per call path: "outer;inner self_microseconds"
+    void write_folded(std::ostream& os) const;
+
+private:
+    struct WordStats {
+        uint64_t calls = 0;
+        uint64_t self_ns = 0;
+        uint64_t inclusive_ns = 0;
+
+        // Active calls, recursive calls count towards inclusive time once
+        uint32_t active = 0;
+    };
+
+    struct PathNode {
+        SymbolId id;
+        size_t parent;
+        uint64_t self_ns = 0;
+        std::unordered_map<SymbolId, size_t> children;
+    };
+
+    struct ActiveCall {
+        size_t node;
+        uint64_t start;
+        uint64_t children_ns;
+    };
+
+    std::unordered_map<SymbolId, WordStats> words;
+
+    // Node 0 is the root of all call paths
+    std::vector<PathNode> nodes = {PathNode{0, 0}};
+    std::vector<ActiveCall> calls;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include "simd_kernels.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__)
+extern const ArrayKernels SSE_KERNELS;
+extern const ArrayKernels AVX2_KERNELS;
+#endif
+
+static const ArrayKernels SCALAR_KERNELS = kernel_table<ScalarOps<int64_t>, ScalarOps<double>>("scalar");
+
+// Widest instruction set allowed by PFIX_SIMD: 0 scalar, 1 sse, 2 avx2
+static int allowed_level() {
+    const char* requested = std::getenv("PFIX_SIMD");
+    if(requested == nullptr) return 2;
+    if(std::strcmp(requested, "scalar") == 0) return 0;
+    if(std::strcmp(requested, "sse") == 0) return 1;
+    return 2;
+}
+
+static const ArrayKernels& select_kernels() {
+    int level = allowed_level();
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if(level >= 2 && __builtin_cpu_supports("avx2")) return AVX2_KERNELS;
+    if(level >= 1 && __builtin_cpu_supports("sse4.2")) return SSE_KERNELS;
+#endif
+    (void)level;
+    return SCALAR_KERNELS;
+}
+
+const ArrayKernels& array_kernels() {
+    static const ArrayKernels& kernels = select_kernels();
+    return kernels;
+}
@@ -0,0 +1,44 @@
+#ifndef __PFIX_SIMD_HPP__
+#define __PFIX_SIMD_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+enum class ArrOp {
+    ADD,
+    SUB,
+    MUL,
+    DIV,    // only on :Flt
+};
+
+// Element-wise and reduction kernels over packed arrays. Every instruction
+// set has its own table, built from simd_kernels.hpp in its own translation
+// unit. :Int kernels stop at the first result that does not fit into 64
+// bits, the caller continues with big integers.
+struct ArrayKernels {
+    const char* name;
+
+    // out[i] = x[i] op y[i], or y op x[i] with swap. out may be x.
+    // Returns the number of elements written before the first overflow.
+    size_t (*int_op)(ArrOp op, const int64_t* x, const int64_t* y, int64_t* out, size_t n);
+    size_t (*int_op_scalar)(ArrOp op, const int64_t* x, int64_t y, int64_t* out, size_t n, bool swap);
+
+    // false on overflow
+    bool (*int_sum)(const int64_t* x, size_t n, int64_t& result);
+    int64_t (*int_min)(const int64_t* x, size_t n);
+    int64_t (*int_max)(const int64_t* x, size_t n);
+    bool (*int_dot)(const int64_t* x, const int64_t* y, size_t n, int64_t& result);
+
+    void (*flt_op)(ArrOp op, const double* x, const double* y, double* out, size_t n);
+    void (*flt_op_scalar)(ArrOp op, const double* x, double y, double* out, size_t n, bool swap);
+    double (*flt_sum)(const double* x, size_t n);
+    double (*flt_min)(const double* x, size_t n);
+    double (*flt_max)(const double* x, size_t n);
+    double (*flt_dot)(const double* x, const double* y, size_t n);
+};
+
+// The widest kernels the processor supports, chosen on first use.
+// PFIX_SIMD=scalar, sse or avx2 in the environment picks a narrower set.
+const ArrayKernels& array_kernels();
+
+#endif
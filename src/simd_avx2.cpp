@@ -0,0 +1,48 @@
+#include "simd_kernels.hpp"
+
+// Compiled with -mavx2
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+namespace {
+
+struct Avx2Int {
+    using scalar = int64_t;
+    using reg = __m256i;
+    static constexpr size_t width = 4;
+
+    static reg load(const int64_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static void store(int64_t* p, reg x) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x); }
+    static reg set1(int64_t x) { return _mm256_set1_epi64x(x); }
+    static reg add(reg a, reg b) { return _mm256_add_epi64(a, b); }
+    static reg sub(reg a, reg b) { return _mm256_sub_epi64(a, b); }
+    static reg min(reg a, reg b) { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)); }
+    static reg max(reg a, reg b) { return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b)); }
+    static reg and_(reg a, reg b) { return _mm256_and_si256(a, b); }
+    static reg or_(reg a, reg b) { return _mm256_or_si256(a, b); }
+    static reg xor_(reg a, reg b) { return _mm256_xor_si256(a, b); }
+    static bool any_negative(reg x) { return _mm256_movemask_pd(_mm256_castsi256_pd(x)) != 0; }
+};
+
+struct Avx2Flt {
+    using scalar = double;
+    using reg = __m256d;
+    static constexpr size_t width = 4;
+
+    static reg load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, reg x) { _mm256_storeu_pd(p, x); }
+    static reg set1(double x) { return _mm256_set1_pd(x); }
+    static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+    static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+    static reg div(reg a, reg b) { return _mm256_div_pd(a, b); }
+    static reg min(reg a, reg b) { return _mm256_min_pd(b, a); }
+    static reg max(reg a, reg b) { return _mm256_max_pd(b, a); }
+};
+
+}
+
+extern const ArrayKernels AVX2_KERNELS = kernel_table<Avx2Int, Avx2Flt>("avx2");
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef __PFIX_SIMD_KERNELS_HPP__
+#define __PFIX_SIMD_KERNELS_HPP__
+
+#include "simd.hpp"
+
+#include <stdexcept>
+#include <type_traits>
+
+// Kernels written once over a vector type V, which provides the register
+// type, its width in elements and the operations on registers.
+// Included by one translation unit per instruction set, compiled with the
+// flags for that set. Everything is in an anonymous namespace so that the
+// linker never picks a copy compiled for a wider set than the processor has.
+namespace {
+
+template<typename T>
+struct ScalarOps {
+    using scalar = T;
+    using reg = T;
+    static constexpr size_t width = 1;
+
+    static reg load(const T* p) { return *p; }
+    static void store(T* p, reg x) { *p = x; }
+    static reg set1(T x) { return x; }
+
+    static reg add(reg a, reg b) {
+        if constexpr(std::is_integral<T>()) return T(std::make_unsigned_t<T>(a) + std::make_unsigned_t<T>(b));
+        else return a + b;
+    }
+    static reg sub(reg a, reg b) {
+        if constexpr(std::is_integral<T>()) return T(std::make_unsigned_t<T>(a) - std::make_unsigned_t<T>(b));
+        else return a - b;
+    }
+    static reg mul(reg a, reg b) {
+        if constexpr(std::is_integral<T>()) return T(std::make_unsigned_t<T>(a) * std::make_unsigned_t<T>(b));
+        else return a * b;
+    }
+    static reg div(reg a, reg b) { return a / b; }
+    static reg min(reg a, reg b) { return b < a ? b : a; }
+    static reg max(reg a, reg b) { return a < b ? b : a; }
+
+    // Bit operations of the :Int kernels
+    static reg and_(reg a, reg b) { return a & b; }
+    static reg or_(reg a, reg b) { return a | b; }
+    static reg xor_(reg a, reg b) { return a ^ b; }
+    static bool any_negative(reg x) { return x < 0; }
+};
+
+struct Add { template<typename V> static typename V::reg apply(typename V::reg a, typename V::reg b) { return V::add(a, b); } };
+struct Sub { template<typename V> static typename V::reg apply(typename V::reg a, typename V::reg b) { return V::sub(a, b); } };
+struct Mul { template<typename V> static typename V::reg apply(typename V::reg a, typename V::reg b) { return V::mul(a, b); } };
+struct Div { template<typename V> static typename V::reg apply(typename V::reg a, typename V::reg b) { return V::div(a, b); } };
+struct Min { template<typename V> static typename V::reg apply(typename V::reg a, typename V::reg b) { return V::min(a, b); } };
+struct Max { template<typename V> static typename V::reg apply(typename V::reg a, typename V::reg b) { return V::max(a, b); } };
+
+template<typename V>
+struct Kernels {
+    using T = typename V::scalar;
+    using S = ScalarOps<T>;
+
+    template<typename Op>
+    static void map(const T* x, const T* y, T* out, size_t n) {
+        size_t i = 0;
+        for(; i + V::width <= n; i += V::width) {
+            V::store(out + i, Op::template apply<V>(V::load(x + i), V::load(y + i)));
+        }
+        for(; i < n; i++) out[i] = Op::template apply<S>(x[i], y[i]);
+    }
+
+    template<typename Op, bool swap>
+    static void map_scalar(const T* x, T y, T* out, size_t n) {
+        auto ys = V::set1(y);
+        size_t i = 0;
+        for(; i + V::width <= n; i += V::width) {
+            auto xs = V::load(x + i);
+            V::store(out + i, swap ? Op::template apply<V>(ys, xs) : Op::template apply<V>(xs, ys));
+        }
+        for(; i < n; i++) out[i] = swap ? Op::template apply<S>(y, x[i]) : Op::template apply<S>(x[i], y);
+    }
+
+    // Lanes are folded in order once the vector part is done
+    template<typename Op>
+    static T fold(typename V::reg acc, T result) {
+        T lanes[V::width];
+        V::store(lanes, acc);
+        for(size_t i = 0; i < V::width; i++) result = Op::template apply<S>(result, lanes[i]);
+        return result;
+    }
+
+    template<typename Op>
+    static T reduce(const T* x, size_t n, T init) {
+        size_t i = 0;
+        T result = init;
+        if(n >= V::width) {
+            auto acc = V::set1(init);
+            for(; i + V::width <= n; i += V::width) acc = Op::template apply<V>(acc, V::load(x + i));
+            result = fold<Op>(acc, init);
+        }
+        for(; i < n; i++) result = Op::template apply<S>(result, x[i]);
+        return result;
+    }
+
+    static void op(ArrOp op, const T* x, const T* y, T* out, size_t n) {
+        switch(op) {
+            case ArrOp::ADD: return map<Add>(x, y, out, n);
+            case ArrOp::SUB: return map<Sub>(x, y, out, n);
+            case ArrOp::MUL: return map<Mul>(x, y, out, n);
+            case ArrOp::DIV:
+                if constexpr(std::is_floating_point<T>()) return map<Div>(x, y, out, n);
+                break;
+        }
+        throw std::logic_error("Invalid array operation");
+    }
+
+    static void op_scalar(ArrOp op, const T* x, T y, T* out, size_t n, bool swap) {
+        switch(op) {
+            case ArrOp::ADD: return map_scalar<Add, false>(x, y, out, n);
+            case ArrOp::SUB: return swap ? map_scalar<Sub, true>(x, y, out, n) : map_scalar<Sub, false>(x, y, out, n);
+            case ArrOp::MUL: return map_scalar<Mul, false>(x, y, out, n);
+            case ArrOp::DIV:
+                if constexpr(std::is_floating_point<T>()) {
+                    return swap ? map_scalar<Div, true>(x, y, out, n) : map_scalar<Div, false>(x, y, out, n);
+                }
+                break;
+        }
+        throw std::logic_error("Invalid array operation");
+    }
+
+    static T sum(const T* x, size_t n) { return reduce<Add>(x, n, T(0)); }
+    static T min(const T* x, size_t n) { return reduce<Min>(x, n, x[0]); }
+    static T max(const T* x, size_t n) { return reduce<Max>(x, n, x[0]); }
+
+    static T dot(const T* x, const T* y, size_t n) {
+        size_t i = 0;
+        T result = T(0);
+        if(n >= V::width) {
+            auto acc = V::set1(T(0));
+            for(; i + V::width <= n; i += V::width) acc = V::add(acc, V::mul(V::load(x + i), V::load(y + i)));
+            result = fold<Add>(acc, result);
+        }
+        for(; i < n; i++) result = S::add(result, S::mul(x[i], y[i]));
+        return result;
+    }
+};
+
+// :Int kernels over 64 bit lanes. Sums and differences are computed with
+// wrap around and only stored if no lane overflowed, which shows in the
+// sign bit of the operands combined with the result. There is no 64 bit
+// vector multiply below AVX-512, products are checked one by one.
+template<typename V>
+struct IntKernels {
+    using T = int64_t;
+    using reg = typename V::reg;
+
+    template<ArrOp Op>
+    static reg apply(reg a, reg b) {
+        if constexpr(Op == ArrOp::ADD) return V::add(a, b);
+        else return V::sub(a, b);
+    }
+
+    template<ArrOp Op>
+    static reg overflow(reg a, reg b, reg r) {
+        if constexpr(Op == ArrOp::ADD) return V::and_(V::xor_(a, r), V::xor_(b, r));
+        else return V::and_(V::xor_(a, b), V::xor_(a, r));
+    }
+
+    template<ArrOp Op>
+    static bool checked(T x, T y, T& r) {
+        if constexpr(Op == ArrOp::ADD) return !__builtin_add_overflow(x, y, &r);
+        else if constexpr(Op == ArrOp::SUB) return !__builtin_sub_overflow(x, y, &r);
+        else return !__builtin_mul_overflow(x, y, &r);
+    }
+
+    template<ArrOp Op>
+    static size_t map(const T* x, const T* y, T* out, size_t n) {
+        size_t i = 0;
+        if constexpr(Op != ArrOp::MUL) {
+            for(; i + V::width <= n; i += V::width) {
+                auto a = V::load(x + i);
+                auto b = V::load(y + i);
+                auto r = apply<Op>(a, b);
+                if(V::any_negative(overflow<Op>(a, b, r))) break;
+                V::store(out + i, r);
+            }
+        }
+        for(; i < n; i++) {
+            T r;
+            if(!checked<Op>(x[i], y[i], r)) return i;
+            out[i] = r;
+        }
+        return n;
+    }
+
+    template<ArrOp Op, bool swap>
+    static size_t map_scalar(const T* x, T y, T* out, size_t n) {
+        size_t i = 0;
+        if constexpr(Op != ArrOp::MUL) {
+            auto ys = V::set1(y);
+            for(; i + V::width <= n; i += V::width) {
+                auto xs = V::load(x + i);
+                auto a = swap ? ys : xs;
+                auto b = swap ? xs : ys;
+                auto r = apply<Op>(a, b);
+                if(V::any_negative(overflow<Op>(a, b, r))) break;
+                V::store(out + i, r);
+            }
+        }
+        for(; i < n; i++) {
+            T r;
+            if(!(swap ? checked<Op>(y, x[i], r) : checked<Op>(x[i], y, r))) return i;
+            out[i] = r;
+        }
+        return n;
+    }
+
+    static size_t op(ArrOp op, const T* x, const T* y, T* out, size_t n) {
+        switch(op) {
+            case ArrOp::ADD: return map<ArrOp::ADD>(x, y, out, n);
+            case ArrOp::SUB: return map<ArrOp::SUB>(x, y, out, n);
+            case ArrOp::MUL: return map<ArrOp::MUL>(x, y, out, n);
+            case ArrOp::DIV: break;
+        }
+        throw std::logic_error("Invalid array operation");
+    }
+
+    static size_t op_scalar(ArrOp op, const T* x, T y, T* out, size_t n, bool swap) {
+        switch(op) {
+            case ArrOp::ADD: return map_scalar<ArrOp::ADD, false>(x, y, out, n);
+            case ArrOp::SUB:
+                return swap ? map_scalar<ArrOp::SUB, true>(x, y, out, n) : map_scalar<ArrOp::SUB, false>(x, y, out, n);
+            case ArrOp::MUL: return map_scalar<ArrOp::MUL, false>(x, y, out, n);
+            case ArrOp::DIV: break;
+        }
+        throw std::logic_error("Invalid array operation");
+    }
+
+    static bool sum(const T* x, size_t n, T& result) {
+        size_t i = 0;
+        result = 0;
+        if(n >= V::width) {
+            auto acc = V::set1(0);
+            auto overflowed = V::set1(0);
+            for(; i + V::width <= n; i += V::width) {
+                auto b = V::load(x + i);
+                auto r = V::add(acc, b);
+                overflowed = V::or_(overflowed, overflow<ArrOp::ADD>(acc, b, r));
+                acc = r;
+            }
+            if(V::any_negative(overflowed)) return false;
+
+            T lanes[V::width];
+            V::store(lanes, acc);
+            for(auto lane : lanes) {
+                if(__builtin_add_overflow(result, lane, &result)) return false;
+            }
+        }
+        for(; i < n; i++) {
+            if(__builtin_add_overflow(result, x[i], &result)) return false;
+        }
+        return true;
+    }
+
+    static T min(const T* x, size_t n) { return Kernels<V>::min(x, n); }
+    static T max(const T* x, size_t n) { return Kernels<V>::max(x, n); }
+
+    static bool dot(const T* x, const T* y, size_t n, T& result) {
+        result = 0;
+        for(size_t i = 0; i < n; i++) {
+            T product;
+            if(__builtin_mul_overflow(x[i], y[i], &product) || __builtin_add_overflow(result, product, &result)) return false;
+        }
+        return true;
+    }
+};
+
+template<typename IntOps, typename FltOps>
+ArrayKernels kernel_table(const char* name) {
+    using I = IntKernels<IntOps>;
+    using F = Kernels<FltOps>;
+    return {
+        name,
+        I::op, I::op_scalar, I::sum, I::min, I::max, I::dot,
+        F::op, F::op_scalar, F::sum, F::min, F::max, F::dot,
+    };
+}
+
+}
+
+#endif
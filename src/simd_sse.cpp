@@ -0,0 +1,48 @@
+#include "simd_kernels.hpp"
+
+// Compiled with -msse4.2, 64 bit comparisons for min/max need SSE4.2
+#if defined(__x86_64__)
+
+#include <nmmintrin.h>
+
+namespace {
+
+struct SseInt {
+    using scalar = int64_t;
+    using reg = __m128i;
+    static constexpr size_t width = 2;
+
+    static reg load(const int64_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    static void store(int64_t* p, reg x) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x); }
+    static reg set1(int64_t x) { return _mm_set1_epi64x(x); }
+    static reg add(reg a, reg b) { return _mm_add_epi64(a, b); }
+    static reg sub(reg a, reg b) { return _mm_sub_epi64(a, b); }
+    static reg min(reg a, reg b) { return _mm_blendv_epi8(a, b, _mm_cmpgt_epi64(a, b)); }
+    static reg max(reg a, reg b) { return _mm_blendv_epi8(b, a, _mm_cmpgt_epi64(a, b)); }
+    static reg and_(reg a, reg b) { return _mm_and_si128(a, b); }
+    static reg or_(reg a, reg b) { return _mm_or_si128(a, b); }
+    static reg xor_(reg a, reg b) { return _mm_xor_si128(a, b); }
+    static bool any_negative(reg x) { return _mm_movemask_pd(_mm_castsi128_pd(x)) != 0; }
+};
+
+struct SseFlt {
+    using scalar = double;
+    using reg = __m128d;
+    static constexpr size_t width = 2;
+
+    static reg load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, reg x) { _mm_storeu_pd(p, x); }
+    static reg set1(double x) { return _mm_set1_pd(x); }
+    static reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+    static reg sub(reg a, reg b) { return _mm_sub_pd(a, b); }
+    static reg mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+    static reg div(reg a, reg b) { return _mm_div_pd(a, b); }
+    static reg min(reg a, reg b) { return _mm_min_pd(b, a); }
+    static reg max(reg a, reg b) { return _mm_max_pd(b, a); }
+};
+
+}
+
+extern const ArrayKernels SSE_KERNELS = kernel_table<SseInt, SseFlt>("sse4.2");
+
+#endif
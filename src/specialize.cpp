@@ -0,0 +1,361 @@
+#include "compiler.hpp"
+
+#include <algorithm>
+
+// Typed variants of functions with fully typed parameters.
+// The optimized body is interpreted abstractly, tracking the type of the
+// entries on the stack and of the frame slots. Builtin arithmetic on two
+// operands of the same known type becomes an unboxed instruction, so the
+// only type check left is the guard on the arguments when entering.
+
+namespace {
+
+const TypeTag UNKNOWN = TypeTag::OBJ;
+
+TypeTag parse_type(const std::string& name) {
+    for(auto tag : {TypeTag::BOOL, TypeTag::INT, TypeTag::FLT, TypeTag::STR, TypeTag::ARR, TypeTag::EXE_ARR, TypeTag::SYM}) {
+        if(type_to_string(tag) == name) return tag;
+    }
+    return UNKNOWN;
+}
+
+bool numeric(TypeTag tag) {
+    return tag == TypeTag::INT || tag == TypeTag::FLT;
+}
+
+// Type of the value a builtin leaves on the stack. Logical operators only
+// replace their operands by one :Bool if the top is a :Bool.
+enum class Result { ARITH, INT, FLT, BOOL, LOGICAL, SYM };
+
+struct Word {
+    const char* name;
+    int arity;
+    Result result;
+    TypedOp op;
+    bool on_int;
+    bool on_flt;
+};
+
+const Word WORDS[] = {
+    {"+", 2, Result::ARITH, TypedOp::ADD, true, true},
+    {"-", 2, Result::ARITH, TypedOp::SUB, true, true},
+    {"*", 2, Result::ARITH, TypedOp::MUL, true, true},
+    {"/", 2, Result::FLT, TypedOp::DIV, false, true},
+    {"i/", 2, Result::ARITH, TypedOp::DIV, true, false},
+    {"mod", 2, Result::INT, TypedOp::MOD, true, false},
+    {"<", 2, Result::BOOL, TypedOp::LESS, true, true},
+    {">", 2, Result::BOOL, TypedOp::GREATER, true, true},
+    {"<=", 2, Result::BOOL, TypedOp::LESS_EQUAL, true, true},
+    {">=", 2, Result::BOOL, TypedOp::GREATER_EQUAL, true, true},
+    {"and", 2, Result::LOGICAL},
+    {"or", 2, Result::LOGICAL},
+    {"=", 2, Result::BOOL, TypedOp::EQUAL, true, true},
+    {"!=", 2, Result::BOOL, TypedOp::NOT_EQUAL, true, true},
+    {"not", 1, Result::BOOL},
+    {"int->flt", 1, Result::FLT},
+    {"type", 1, Result::SYM},
+};
+
+const Word* find_word(SymbolId id) {
+    auto& name = symbol_name(id);
+    for(auto& it : WORDS) {
+        if(name == it.name) return &it;
+    }
+    return nullptr;
+}
+
+TypeTag result_type(const Word& word, TypeTag x1, TypeTag x2) {
+    switch(word.result) {
+        case Result::ARITH:
+            if(x1 == TypeTag::INT && x2 == TypeTag::INT) return TypeTag::INT;
+            return numeric(x1) && numeric(x2) ? TypeTag::FLT : UNKNOWN;
+        case Result::INT: return x1 == TypeTag::INT && x2 == TypeTag::INT ? TypeTag::INT : UNKNOWN;
+        case Result::FLT: return TypeTag::FLT;
+        case Result::BOOL:
+        case Result::LOGICAL: return TypeTag::BOOL;
+        case Result::SYM: return TypeTag::SYM;
+    }
+    return UNKNOWN;
+}
+
+// Types before an instruction. Below the known part of the stack are the
+// values of the caller, unless exact is false after a call with an
+// unknown stack effect.
+struct State {
+    bool reached = false;
+    bool exact = true;
+    std::vector<TypeTag> stack;
+    std::vector<TypeTag> slots;
+};
+
+class Specializer {
+private:
+    const Code& code;
+    PfixScope& scope;
+    SymbolId self;
+    const std::vector<TypeTag>& guard;
+
+    // Signature assumed for recursive calls, verified once the body is done
+    const std::vector<TypeTag>* self_returns = nullptr;
+
+    std::vector<State> states;
+    std::vector<size_t> work;
+
+    // Whether the body pops values of its caller
+    bool consumed = false;
+
+    TypeTag pop(State& state) {
+        if(state.stack.empty()) {
+            if(state.exact) consumed = true;
+            return UNKNOWN;
+        }
+        auto tag = state.stack.back();
+        state.stack.pop_back();
+        return tag;
+    }
+
+    void forget(State& state) {
+        state.stack.clear();
+        state.exact = false;
+    }
+
+    void assume(SymbolId id) {
+        if(std::find(assumptions.begin(), assumptions.end(), id) == assumptions.end()) {
+            assumptions.push_back(id);
+        }
+    }
+
+    const Word* builtin(SymbolId id) {
+        auto binding = scope.lookup(id);
+        if(binding == nullptr || binding->tag != TypeTag::NATIVE_SYM || !binding->as<NativeSym>()->pure
+            || PfixDictionary::shadow_count(id) != 0) return nullptr;
+        return find_word(id);
+    }
+
+    // Calls to functions with a verified signature and arguments that pass their guard
+    bool call_signature(SymbolId id, State& state) {
+        const std::vector<TypeTag>* params;
+        const std::vector<TypeTag>* returns;
+        if(PfixDictionary::shadow_count(id) != 0) return false;
+
+        if(id == self) {
+            if(self_returns == nullptr) return false;
+            params = &guard;
+            returns = self_returns;
+        } else {
+            auto binding = scope.lookup(id);
+            if(binding == nullptr || binding->tag != TypeTag::EXE_ARR) return false;
+            auto& callee = binding->as<ExeArr>()->code;
+            if(!callee || !callee->typed || !callee->typed->has_signature || !callee->typed->assumptions_hold()) return false;
+            params = &callee->guard;
+            returns = &callee->typed->returns;
+            for(auto it : callee->typed->assumptions) assume(it);
+        }
+
+        if(state.stack.size() < params->size()
+            || !std::equal(params->begin(), params->end(), state.stack.end() - params->size())) return false;
+
+        assume(id);
+        state.stack.resize(state.stack.size() - params->size());
+        state.stack.insert(state.stack.end(), returns->begin(), returns->end());
+        return true;
+    }
+
+    // Apply the instruction at pc to state, rewriting it into out if its operand types allow
+    void step(size_t pc, State& state, Instruction* out) {
+        auto& ins = code.instructions[pc];
+        switch(ins.op) {
+            case OpCode::PUSH_CONST:
+                state.stack.push_back(code.constants[ins.arg].tag);
+                break;
+            case OpCode::LOAD_LOCAL:
+                state.stack.push_back(state.slots[ins.arg]);
+                break;
+            case OpCode::STORE_LOCAL:
+                state.slots[ins.arg] = pop(state);
+                break;
+            case OpCode::STORE:
+            case OpCode::JUMP_IF_FALSE:
+                pop(state);
+                break;
+            case OpCode::JUMP:
+                break;
+            case OpCode::CALL: {
+                auto word = builtin(ins.arg);
+                if(word != nullptr && word->result == Result::LOGICAL
+                    && (state.stack.empty() || state.stack.back() != TypeTag::BOOL)) word = nullptr;
+                if(word == nullptr) {
+                    if(!call_signature(ins.arg, state)) forget(state);
+                    break;
+                }
+
+                assume(ins.arg);
+                auto x2 = word->arity == 2 ? pop(state) : UNKNOWN;
+                auto x1 = pop(state);
+                if(out != nullptr && word->arity == 2 && x1 == x2) {
+                    if(x1 == TypeTag::INT && word->on_int) *out = {OpCode::INT_OP, uint32_t(word->op)};
+                    if(x1 == TypeTag::FLT && word->on_flt) *out = {OpCode::FLT_OP, uint32_t(word->op)};
+                }
+                state.stack.push_back(result_type(*word, x1, x2));
+                break;
+            }
+            case OpCode::ADD_CONST:
+            case OpCode::SUB_CONST:
+            case OpCode::LESS_CONST:
+            case OpCode::GREATER_CONST:
+            case OpCode::LESS_EQUAL_CONST:
+            case OpCode::GREATER_EQUAL_CONST: {
+                auto word = find_word(fused_word(ins.op));
+                auto x2 = code.constants[ins.arg].tag;
+                auto x1 = pop(state);
+                if(out != nullptr && x1 == TypeTag::INT && x2 == TypeTag::INT && ins.arg < (1u << 24)) {
+                    *out = {OpCode::INT_CONST_OP, ins.arg << 8 | uint32_t(word->op)};
+                }
+                state.stack.push_back(result_type(*word, x1, x2));
+                break;
+            }
+            default:
+                forget(state);
+        }
+    }
+
+    // Widen the types at pc to include state
+    void merge(size_t pc, const State& state) {
+        auto& into = states[pc];
+        bool changed = false;
+        if(!into.reached) {
+            into = state;
+            changed = true;
+        } else {
+            if(into.exact && !state.exact) {
+                into.exact = false;
+                changed = true;
+            }
+            if(into.stack.size() != state.stack.size()) {
+                if(into.exact || !into.stack.empty()) changed = true;
+                forget(into);
+            } else {
+                for(size_t i = 0; i < into.stack.size(); i++) {
+                    if(into.stack[i] != state.stack[i] && into.stack[i] != UNKNOWN) {
+                        into.stack[i] = UNKNOWN;
+                        changed = true;
+                    }
+                }
+            }
+            for(size_t i = 0; i < into.slots.size(); i++) {
+                if(into.slots[i] != state.slots[i] && into.slots[i] != UNKNOWN) {
+                    into.slots[i] = UNKNOWN;
+                    changed = true;
+                }
+            }
+        }
+        if(changed && pc < code.instructions.size()) work.push_back(pc);
+    }
+
+public:
+    std::vector<SymbolId> assumptions;
+
+    Specializer(const Code& code, PfixScope& scope, SymbolId self, const std::vector<TypeTag>& guard)
+        : code(code), scope(scope), self(self), guard(guard) {}
+
+    // Returns whether the body ends with exactly returns on top of the
+    // values of its caller
+    bool analyze(const std::vector<TypeTag>* returns) {
+        self_returns = returns;
+        assumptions.clear();
+        consumed = false;
+
+        states.assign(code.instructions.size() + 1, State());
+        State entry;
+        entry.reached = true;
+        entry.stack = guard;
+        entry.slots.assign(code.num_locals, UNKNOWN);
+        merge(0, entry);
+
+        while(!work.empty()) {
+            size_t pc = work.back();
+            work.pop_back();
+
+            auto state = states[pc];
+            step(pc, state, nullptr);
+
+            auto& ins = code.instructions[pc];
+            if(ins.op == OpCode::JUMP || ins.op == OpCode::JUMP_IF_FALSE) merge(ins.arg, state);
+            if(ins.op != OpCode::JUMP) merge(pc + 1, state);
+        }
+
+        auto& end = states.back();
+        return end.reached && end.exact && !consumed && returns != nullptr && end.stack == *returns;
+    }
+
+    std::vector<Instruction> rewrite(bool& changed) {
+        auto instructions = code.instructions;
+        for(size_t pc = 0; pc < instructions.size(); pc++) {
+            if(!states[pc].reached) continue;
+            auto state = states[pc];
+            step(pc, state, &instructions[pc]);
+            if(instructions[pc].op != code.instructions[pc].op) changed = true;
+        }
+        return instructions;
+    }
+};
+
+}
+
+void specialize(Code& code, const Params& params, SymbolId self, PfixScope& scope) {
+    code.self = self;
+
+    std::vector<TypeTag> guard;
+    for(auto& it : params.params) {
+        auto tag = parse_type(it.second);
+        if(tag == UNKNOWN) return;
+        guard.push_back(tag);
+    }
+
+    std::vector<TypeTag> returns;
+    for(auto& it : params.ret_types) returns.push_back(parse_type(it));
+    bool typed_returns = std::find(returns.begin(), returns.end(), UNKNOWN) == returns.end();
+
+    // Recursive calls may only rely on the signature if the body keeps it
+    Specializer specializer(code, scope, self, guard);
+    bool verified = typed_returns && specializer.analyze(&returns);
+    if(!verified) specializer.analyze(nullptr);
+
+    bool changed = false;
+    auto instructions = specializer.rewrite(changed);
+    if(!changed && !verified) return;
+
+    auto variant = std::make_shared<Code>();
+    variant->instructions = std::move(instructions);
+    variant->constants = code.constants;
+    variant->caches.resize(variant->instructions.size());
+    variant->num_locals = code.num_locals;
+    variant->needs_scope = code.needs_scope;
+
+    // Typed instructions replace calls one to one, so the variant falls
+    // back to the same baseline as the code it was derived from
+    if(code.baseline.empty()) {
+        variant->baseline = code.instructions;
+        variant->baseline_pc.resize(code.instructions.size() + 1);
+        for(size_t i = 0; i < variant->baseline_pc.size(); i++) variant->baseline_pc[i] = i;
+    } else {
+        variant->baseline = code.baseline;
+        variant->baseline_pc = code.baseline_pc;
+    }
+
+    variant->assumptions = code.assumptions;
+    for(auto id : specializer.assumptions) {
+        if(std::find(variant->assumptions.begin(), variant->assumptions.end(), id) == variant->assumptions.end()) {
+            variant->assumptions.push_back(id);
+        }
+    }
+    for(auto id : variant->assumptions) PfixDictionary::watch(id);
+    variant->definitions = PfixDictionary::definitions;
+
+    variant->self = self;
+    variant->has_signature = verified;
+    if(verified) variant->returns = std::move(returns);
+
+    code.guard = std::move(guard);
+    code.typed = std::move(variant);
+}
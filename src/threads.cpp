@@ -0,0 +1,118 @@
+#include "threads.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+// Pool and queue of the calling thread if it belongs to a pool
+static thread_local PfixThreadPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+PfixThreadPool::PfixThreadPool(size_t num_threads) {
+    for(size_t i = 0; i < std::max<size_t>(1, num_threads); i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for(size_t i = 0; i < workers.size(); i++) {
+        workers[i]->thread = std::thread([this, i]() { work(i); });
+    }
+}
+
+PfixThreadPool::~PfixThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto& worker : workers) worker->thread.join();
+}
+
+PfixThreadPool& PfixThreadPool::shared() {
+    static PfixThreadPool pool([]() -> size_t {
+        const char* requested = std::getenv("PFIX_THREADS");
+        if(requested != nullptr && std::atoi(requested) > 0) return std::atoi(requested);
+        return std::thread::hardware_concurrency();
+    }());
+    return pool;
+}
+
+void PfixThreadPool::work(size_t self) {
+    current_pool = this;
+    current_worker = self;
+
+    for(;;) {
+        if(run_one(self)) continue;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this]() { return stopping || queued > 0; });
+        if(stopping && queued == 0) return;
+    }
+}
+
+// Runs a task from the queue of self, or one stolen from another queue
+bool PfixThreadPool::run_one(size_t self) {
+    for(size_t i = 0; i < workers.size(); i++) {
+        auto& worker = *workers[(self + i) % workers.size()];
+        std::unique_lock<std::mutex> lock(worker.mutex);
+        if(worker.items.empty()) continue;
+
+        Item item;
+        if(i == 0) {
+            item = worker.items.back();
+            worker.items.pop_back();
+        } else {
+            item = worker.items.front();
+            worker.items.pop_front();
+        }
+        lock.unlock();
+        queued--;
+
+        try {
+            (*item.task)();
+        } catch(...) {
+            item.batch->errors[item.index] = std::current_exception();
+        }
+        finish(item);
+        return true;
+    }
+    return false;
+}
+
+void PfixThreadPool::finish(const Item& item) {
+    // The waiting thread may destroy the batch as soon as it gets the lock
+    std::lock_guard<std::mutex> lock(item.batch->mutex);
+    if(--item.batch->remaining == 0) item.batch->done.notify_all();
+}
+
+void PfixThreadPool::run(std::vector<Task>& tasks) {
+    if(tasks.empty()) return;
+
+    Batch batch;
+    batch.remaining = tasks.size();
+    batch.errors.resize(tasks.size());
+
+    // Counted before they are queued, so that queued never drops below zero
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued += tasks.size();
+    }
+    size_t first = next.fetch_add(1);
+    for(size_t i = 0; i < tasks.size(); i++) {
+        auto& worker = *workers[(first + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.items.push_back({&tasks[i], i, &batch});
+    }
+    wake.notify_all();
+
+    // A task waiting for other tasks would block its thread, it helps out instead
+    if(current_pool == this) {
+        while(batch.remaining > 0) {
+            if(!run_one(current_worker)) std::this_thread::yield();
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(batch.mutex);
+    batch.done.wait(lock, [&batch]() { return batch.remaining == 0; });
+
+    for(auto& error : batch.errors) {
+        if(error) std::rethrow_exception(error);
+    }
+}
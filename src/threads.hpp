@@ -0,0 +1,72 @@
+#ifndef __PFIX_THREADS_HPP__
+#define __PFIX_THREADS_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads with one task queue each. A thread runs the tasks
+// of its own queue newest first and steals the oldest task of another
+// queue once its own is empty.
+class PfixThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit PfixThreadPool(size_t num_threads);
+    PfixThreadPool(const PfixThreadPool&) = delete;
+    ~PfixThreadPool();
+
+    // One thread per core, PFIX_THREADS in the environment sets the number.
+    // Created on first use.
+    static PfixThreadPool& shared();
+
+    size_t size() const { return workers.size(); }
+
+    // Run all tasks and wait until they are done. If tasks throw, the
+    // exception of the first of them is rethrown. Called from a task, the
+    // thread runs queued tasks while it waits.
+    void run(std::vector<Task>& tasks);
+
+private:
+    // Tasks of one call to run
+    struct Batch {
+        std::mutex mutex;
+        std::condition_variable done;
+        std::atomic<size_t> remaining;
+        std::vector<std::exception_ptr> errors;
+    };
+
+    struct Item {
+        Task* task;
+        size_t index;
+        Batch* batch;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Item> items;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    // Sleeping threads wait for queued to become non-zero
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{0};
+    bool stopping = false;
+
+    // Queue the next batch starts at, so that small batches spread out
+    std::atomic<size_t> next{0};
+
+    void work(size_t self);
+    bool run_one(size_t self);
+    void finish(const Item& item);
+};
+
+#endif
@@ -1,5 +1,50 @@
 #include "types.hpp"
 
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+
+// The keys of ids view into names, which never moves its strings.
+// Shared by all threads, interning takes the lock exclusively.
+struct SymbolTable {
+    std::unordered_map<std::string_view, SymbolId> ids;
+    std::deque<std::string> names;
+    std::shared_mutex mutex;
+};
+
+SymbolTable& symbol_table() {
+    static SymbolTable table;
+    return table;
+}
+
+SymbolId intern(std::string_view name) {
+    auto& table = symbol_table();
+    {
+        std::shared_lock<std::shared_mutex> lock(table.mutex);
+        auto iter = table.ids.find(name);
+        if(iter != table.ids.end()) return iter->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(table.mutex);
+    auto iter = table.ids.find(name);
+    if(iter != table.ids.end()) return iter->second;
+
+    SymbolId id = table.names.size();
+    table.names.emplace_back(name);
+    table.ids.emplace(table.names.back(), id);
+    return id;
+}
+
+const std::string& symbol_name(SymbolId id) {
+    auto& table = symbol_table();
+    std::shared_lock<std::shared_mutex> lock(table.mutex);
+    return table.names[id];
+}
+
+bool is_literal_symbol(std::string_view sym) {
+    return sym[0] == ':' || sym[sym.size()-1] == ':' || sym == "[" || sym == "->";
+}
+
 bool is_type(const std::string& str) {
     return (str[0] == ':' || str[str.size()-1] == ':');// && std::isupper(str[1]);
 }
@@ -16,47 +61,152 @@ std::string type_to_string(TypeTag tag) {
         case TypeTag::PARAMS: return ":Params";
         case TypeTag::SYM: return ":Sym";
         case TypeTag::NATIVE_SYM: return ":NativeSym";
+        case TypeTag::INT_ARR:
+        case TypeTag::FLT_ARR: return ":Arr";
+        case TypeTag::BIG_INT: return ":Int";
     }
     throw std::logic_error("not implemented");
 }
 
-std::unique_ptr<Obj> PfixStack::pop() {
+std::ostream& Value::print(std::ostream& os) const {
+    switch(tag) {
+        case TypeTag::BOOL: os << (b ? "true" : "false"); break;
+        case TypeTag::INT: os << i; break;
+        case TypeTag::FLT: os << f; break;
+        default: if(obj != nullptr) obj->print(os);
+    }
+    return os;
+}
+
+Value PfixStack::pop() {
     if(this->empty()) throw std::runtime_error("Stack is empty and cannot be popped");
     auto x = std::move(this->back());
     this->pop_back();
     return x;
 }
 
-void PfixStack::pushInt(int i) {
-    this->push_back(std::make_unique<Int>(i));
+void PfixStack::pushInt(int64_t i) {
+    this->emplace_back(i);
 }
 
-int PfixStack::popInt() {
-    return dynamic_cast<Int*>(this->pop().get())->i;
+int64_t PfixStack::popInt() {
+    if(!this->empty() && this->back().tag == TypeTag::BIG_INT) throw std::runtime_error("Expected an :Int of at most 64 bits");
+    expect(TypeTag::INT);
+    return this->pop().i;
 }
 
 void PfixStack::expect(TypeTag tag) {
-    if(!(this->size() > 0 && this->back()->tag == tag)) {
+    if(!(this->size() > 0 && this->back().tag == tag)) {
         if(this->size() > 0) {
-            throw std::runtime_error("Expected " + type_to_string(tag) + ", found " + type_to_string(this->back()->tag));
+            throw std::runtime_error("Expected " + type_to_string(tag) + ", found " + type_to_string(this->back().tag));
         } else {
             throw std::runtime_error("Expected type" + type_to_string(tag));
         }
     }
 }
 
-std::ostream& PfixDictionary::print(std::ostream& os) {
-    std::cout << "{ ";
-    for(auto& entry : *this) {
-        std::cout << entry.first << ":";
-        entry.second->print(os) << " ";
+constexpr SymbolId PfixDictionary::EMPTY;
+
+// Storage of counts, released when the thread exits
+struct CountStorage {
+    PfixDictionary::Counts& counts;
+    std::vector<uint32_t> data;
+
+    ~CountStorage() { counts = {nullptr, 0}; }
+
+    void reserve(SymbolId id) {
+        if(id < data.size()) return;
+        data.resize(id + 1);
+        counts = {data.data(), data.size()};
+    }
+};
+
+void PfixDictionary::watch(SymbolId id) {
+    static thread_local CountStorage storage{versions, {}};
+    storage.reserve(id);
+    if(versions.data[id] == 0) versions.data[id] = 1;
+}
+
+void PfixDictionary::reserve_shadows(SymbolId id) {
+    static thread_local CountStorage storage{shadows, {}};
+    storage.reserve(id);
+}
+
+PfixDictionary::PfixDictionary(const PfixDictionary& other)
+    : slots(other.slots), count(other.count), nested(other.nested) {
+    if(nested) add_shadows(1);
+}
+
+PfixDictionary& PfixDictionary::operator=(const PfixDictionary& other) {
+    if(this != &other) {
+        if(nested) add_shadows(-1);
+        else epoch++;
+        slots = other.slots;
+        count = other.count;
+        nested = other.nested;
+        if(nested) add_shadows(1);
+    }
+    return *this;
+}
+
+PfixDictionary::~PfixDictionary() {
+    if(nested) add_shadows(-1);
+    else epoch++;
+}
+
+void PfixDictionary::add_shadows(int delta) {
+    for_each([delta](SymbolId id, const Binding&) {
+        reserve_shadows(id);
+        shadows.data[id] += delta;
+    });
+}
+
+// Symbol ids are dense and sequential, so the id itself is used as hash
+PfixDictionary::Binding& PfixDictionary::operator[](SymbolId id) {
+    if((count + 1) * 4 > slots.size() * 3) grow();
+
+    if(versions.get(id) != 0) versions.data[id] = ++definitions;
+
+    size_t i = id & mask();
+    while(slots[i].first != id && slots[i].first != EMPTY) i = (i + 1) & mask();
+
+    if(slots[i].first == EMPTY) {
+        slots[i].first = id;
+        count++;
+        if(nested) {
+            reserve_shadows(id);
+            shadows.data[id]++;
+        }
+    }
+    return slots[i].second;
+}
+
+void PfixDictionary::grow() {
+    if(!nested) epoch++;
+    auto old_slots = std::move(slots);
+    slots = std::vector<std::pair<SymbolId, Binding>>(std::max<size_t>(16, old_slots.size() * 2));
+    for(auto& slot : slots) slot.first = EMPTY;
+
+    for(auto& slot : old_slots) {
+        if(slot.first == EMPTY) continue;
+        size_t i = slot.first & mask();
+        while(slots[i].first != EMPTY) i = (i + 1) & mask();
+        slots[i] = std::move(slot);
     }
-    std::cout << "}" << std::endl;
+}
+
+std::ostream& PfixDictionary::print(std::ostream& os) {
+    os << "{ ";
+    for_each([&os](SymbolId id, const Binding& binding) {
+        os << symbol_name(id) << ":";
+        binding.print(os) << " ";
+    });
+    os << "}" << std::endl;
     return os;
 }
 
 void PfixDictionary::define_native(const std::string& sym, PfixStackFunction sf) {
-    this->insert(std::make_pair(sym, std::make_unique<NativeSym>(sf)));
+    if(find(intern(sym)) == nullptr) (*this)[sym] = std::make_unique<NativeSym>(sf);
 }
 
 std::ostream& operator<<(std::ostream& os, PfixDictionary& dictionary) {
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <deque>
@@ -10,6 +11,10 @@
 #include <memory>
 #include <functional>
 #include <algorithm>
+#include <type_traits>
+#include <cstdint>
+
+#include "allocator.hpp"
 
 enum class TypeTag {
     OBJ,
@@ -22,94 +27,278 @@ enum class TypeTag {
     PARAMS,
     SYM,
     NATIVE_SYM,
+    INT_ARR,
+    FLT_ARR,
+    BIG_INT,    // :Int beyond 64 bits, see bigint.hpp
 };
 
 bool is_type(const std::string& str);
 std::string type_to_string(TypeTag tag);
 
+// Symbols are interned once into a global table and referred to by id
+using SymbolId = uint32_t;
+
+SymbolId intern(std::string_view name);
+const std::string& symbol_name(SymbolId id);
+
+// Symbols such as :name, name:, [ and -> are pushed rather than evaluated
+bool is_literal_symbol(std::string_view sym);
+
 class PfixStack;
 class PfixDictionary;
+class PfixScope;
 class Obj;
+class Code;
+class PfixInterpreter;
+
+using PfixEnvironment = std::shared_ptr<PfixScope>;
 
 using PfixStackFunction = std::function<void(PfixStack* s)>;
-using PfixEntryPoint = void (*)(PfixDictionary* dict);
 
-class PfixStack: public std::vector<std::unique_ptr<Obj>> {
+// Native of an extension with a declared signature, see extension.hpp
+struct PfixExtensionNative;
+void call_extension(PfixStack& stack, const PfixExtensionNative& native);
+
+// A tagged 16 byte value.
+// Booleans, 64 bit integers and floats are stored inline, all other types are
+// reference counted heap objects. Copies share the object, it is copied
+// only before a change while other values still refer to it.
+class Value {
+public:
+    TypeTag tag;
+    union {
+        bool b;
+        int64_t i;
+        double f;
+        Obj* obj;
+    };
+
+    Value() : tag(TypeTag::OBJ), obj(nullptr) {}
+    explicit Value(bool b) : tag(TypeTag::BOOL), b(b) {}
+    explicit Value(int64_t i) : tag(TypeTag::INT), i(i) {}
+    explicit Value(int i) : Value(int64_t(i)) {}
+    explicit Value(double f) : tag(TypeTag::FLT), f(f) {}
+
+    template<typename T, typename = std::enable_if_t<std::is_base_of<Obj, T>::value>>
+    Value(std::unique_ptr<T> o);
+
+    Value(const Value& other);
+    Value(Value&& other) noexcept : tag(other.tag), f(other.f) {
+        other.tag = TypeTag::OBJ;
+        other.obj = nullptr;
+    }
+
+    Value& operator=(const Value& other) {
+        if(this != &other) *this = Value(other);
+        return *this;
+    }
+
+    Value& operator=(Value&& other) noexcept {
+        if(this != &other) {
+            release();
+            tag = other.tag;
+            f = other.f;
+            other.tag = TypeTag::OBJ;
+            other.obj = nullptr;
+        }
+        return *this;
+    }
+
+    ~Value() { release(); }
+
+    bool is_immediate() const {
+        return tag == TypeTag::BOOL || tag == TypeTag::INT || tag == TypeTag::FLT;
+    }
+
+    bool is_shared() const;
+
+    template<typename T>
+    T* as() const { return static_cast<T*>(obj); }
+
+    // The object for a change in place, copied first if it is shared
+    template<typename T>
+    T* as_unique();
+
+    std::ostream& print(std::ostream& os) const;
+
+private:
+    void release();
+};
+
+static_assert(sizeof(Value) == 16, "Value is expected to be two words");
+
+class PfixStack: public std::vector<Value> {
 public:
-    std::unique_ptr<Obj> pop();
-    void pushInt(int i);
-    int popInt();
+    // Interpreter the stack belongs to, builtins reach it through here.
+    // Null on stacks that only serve to evaluate pure builtins.
+    PfixInterpreter* context = nullptr;
+
+    Value pop();
+    void pushInt(int64_t i);
+    int64_t popInt();
     void expect(TypeTag tag);
 };
 
-class PfixDictionary : public std::map<std::string, std::shared_ptr<Obj>> {
+// Open addressing hash table from symbol ids to bindings
+class PfixDictionary {
 public:
+    using Binding = Value;
+
+    PfixDictionary(bool nested = false) : nested(nested) {}
+    PfixDictionary(const PfixDictionary& other);
+    PfixDictionary& operator=(const PfixDictionary& other);
+    ~PfixDictionary();
+
+    // Counter per symbol id, grown on demand
+    struct Counts {
+        uint32_t* data;
+        size_t size;
+
+        uint32_t get(SymbolId id) const { return id < size ? data[id] : 0; }
+    };
+
+    // The counters below are per thread, every thread runs its own
+    // interpreters on dictionaries it created itself. They are constant
+    // initialized, so that other translation units access them directly.
+
+    // Bindings of the globals only move when their table grows or is
+    // destroyed. Pointers to them stay valid while the epoch is unchanged.
+    static inline thread_local uint32_t epoch = 1;
+
+    // Number of bindings of a symbol in nested scopes. While it is zero
+    // every scope resolves the symbol to the globals.
+    static uint32_t shadow_count(SymbolId id) { return shadows.get(id); }
+
+    // Compiled code may assume the definition of a watched symbol.
+    // Every store to a binding of it, in any dictionary, gives the symbol
+    // a new version from the definitions counter.
+    static inline thread_local uint32_t definitions = 1;
+    static void watch(SymbolId id);
+    static uint32_t version(SymbolId id) { return versions.get(id); }
+
+    // Versions of all watched symbols on the calling thread
+    static Counts all_versions() { return versions; }
+
+    Binding* find(SymbolId id) {
+        if(count == 0) return nullptr;
+        for(size_t i = id & mask();; i = (i + 1) & mask()) {
+            if(slots[i].first == id) return &slots[i].second;
+            if(slots[i].first == EMPTY) return nullptr;
+        }
+    }
+
+    const Binding* find(SymbolId id) const {
+        return const_cast<PfixDictionary*>(this)->find(id);
+    }
+
+    Binding& operator[](SymbolId id);
+    Binding& operator[](const std::string& sym) { return (*this)[intern(sym)]; }
+
+    size_t size() const { return count; }
+
+    template<typename F>
+    void for_each(F f) const {
+        for(auto& slot : slots) {
+            if(slot.first != EMPTY) f(slot.first, slot.second);
+        }
+    }
+
     std::ostream& print(std::ostream& os);
 
     void define_native(const std::string& sym, PfixStackFunction sf);
 
     friend std::ostream& operator<<(std::ostream& os, PfixDictionary& dictionary);
-};
 
-class Obj {
-public:
-    TypeTag tag = TypeTag::OBJ;
-    virtual ~Obj() = default;
-    virtual std::ostream& print(std::ostream& os) = 0;
-    virtual std::unique_ptr<Obj> copy() = 0;
-protected:
-    Obj(TypeTag t) : tag(t) {}
+private:
+    static constexpr SymbolId EMPTY = UINT32_MAX;
+    static inline thread_local Counts shadows{nullptr, 0};
+    static inline thread_local Counts versions{nullptr, 0};
+
+    static void reserve_shadows(SymbolId id);
+
+    std::vector<std::pair<SymbolId, Binding>> slots;
+    size_t count = 0;
+
+    // Whether this is the dictionary of a scope below the globals
+    bool nested;
+
+    void add_shadows(int delta);
+
+    size_t mask() const { return slots.size() - 1; }
+    void grow();
 };
 
-class Bool : public Obj {
+// A scope of bindings chained to its enclosing scope.
+// Closures keep a reference to the scope they were created in,
+// so capturing an environment and entering a call are O(1).
+class PfixScope {
 public:
-    bool b;
-    Bool(bool b) : Obj(TypeTag::BOOL), b(b) {}
+    // Whether the cycle collector tracks the scope, see collector.hpp
+    enum class Generation : uint8_t { UNTRACKED, YOUNG, OLD };
 
-    virtual std::ostream& print(std::ostream& os) override {
-        os << (b ? "true" : "false");
-        return os;
-    }
+    PfixDictionary bindings;
+    PfixEnvironment parent;
+    Generation generation = Generation::UNTRACKED;
 
-    virtual std::unique_ptr<Obj> copy() override {
-        return std::make_unique<Bool>(b);
+    PfixScope(PfixEnvironment parent = nullptr) : bindings(parent != nullptr), parent(std::move(parent)) {}
+
+    PfixDictionary::Binding* lookup(SymbolId id) {
+        for(auto scope = this; scope != nullptr; scope = scope->parent.get()) {
+            auto binding = scope->bindings.find(id);
+            if(binding != nullptr) return binding;
+        }
+        return nullptr;
     }
 };
 
-class Int : public Obj {
+class Obj {
 public:
-    int i;
-    Int(int i) : Obj(TypeTag::INT), i(i) {}
+    TypeTag tag = TypeTag::OBJ;
 
-    virtual std::ostream& print(std::ostream& os) override {
-        os << i;
-        return os;
-    }
+    // Number of values referring to the object. Not atomic, values belong
+    // to the thread of their interpreter.
+    uint32_t refs = 1;
 
-    virtual std::unique_ptr<Obj> copy() override {
-        return std::make_unique<Int>(i);
-    }
+    virtual ~Obj() = default;
+    virtual std::ostream& print(std::ostream& os) = 0;
+
+    // New object with the same contents, elements are shared
+    virtual std::unique_ptr<Obj> copy() = 0;
+
+    static void* operator new(size_t size) { return pfix_allocate(size); }
+    static void operator delete(void* ptr, size_t size) { pfix_deallocate(ptr, size); }
+protected:
+    Obj(TypeTag t) : tag(t) {}
 };
 
-class Flt : public Obj {
-public:
-    double f;
-    Flt(double f) : Obj(TypeTag::FLT), f(f) {}
+template<typename T, typename>
+Value::Value(std::unique_ptr<T> o) : tag(o->tag), obj(o.release()) {}
 
-    virtual std::ostream& print(std::ostream& os) override {
-        os << f;
-        return os;
-    }
+inline Value::Value(const Value& other) : tag(other.tag), f(other.f) {
+    if(!is_immediate() && obj != nullptr) obj->refs++;
+}
 
-    virtual std::unique_ptr<Obj> copy() override {
-        return std::make_unique<Flt>(f);
+inline void Value::release() {
+    if(!is_immediate() && obj != nullptr && --obj->refs == 0) delete obj;
+}
+
+inline bool Value::is_shared() const {
+    return !is_immediate() && obj != nullptr && obj->refs > 1;
+}
+
+template<typename T>
+T* Value::as_unique() {
+    if(obj->refs > 1) {
+        obj->refs--;
+        obj = obj->copy().release();
     }
-};
+    return static_cast<T*>(obj);
+}
 
 class Str : public Obj {
 public:
     std::string str;
-    Str(std::string& str) : Obj(TypeTag::STR), str(std::move(str)) {}
+    Str(std::string str) : Obj(TypeTag::STR), str(std::move(str)) {}
 
     virtual std::ostream& print(std::ostream& os) override {
         os << str;
@@ -125,15 +314,15 @@ class Arr : public Obj {
 public:
     virtual ~Arr() override = default;
 
-    std::deque<std::unique_ptr<Obj>> vec;
+    std::deque<Value> vec;
 
-    Arr(std::vector<std::unique_ptr<Obj>>&& vec)
+    Arr(std::vector<Value>&& vec)
         : Obj(TypeTag::ARR) {
 
         std::move(vec.begin(), vec.end(), std::back_inserter(this->vec));
     }
 
-    Arr(std::deque<std::unique_ptr<Obj>>&& vec)
+    Arr(std::deque<Value>&& vec)
         : Obj(TypeTag::ARR), vec(std::move(vec)) {}
 
     virtual std::ostream& print(std::ostream& os) override {
@@ -141,7 +330,7 @@ public:
         os << "[";
         std::for_each(vec.begin(), vec.end(), [&os, &comma](auto& t) {
             if(comma) os << ", ";
-            t->print(os);
+            t.print(os);
             comma = true;
         });
         os << "]";
@@ -149,34 +338,62 @@ public:
     }
 
     virtual std::unique_ptr<Obj> copy() override {
-        std::deque<std::unique_ptr<Obj>> copy_vec;
-        std::transform(vec.begin(), vec.end(), std::back_inserter(copy_vec), [](auto& x) {
-            return x->copy();
-        });
+        std::deque<Value> copy_vec(vec);
         return std::make_unique<Arr>(std::move(copy_vec));
     }
 };
 
+// Array whose elements all have the same numeric type, stored unboxed.
+// ] packs arrays of only :Int or only :Flt, see arrays.hpp.
+template<typename T, TypeTag Tag>
+class PackedArr : public Obj {
+public:
+    std::vector<T> vec;
+
+    PackedArr(std::vector<T> vec) : Obj(Tag), vec(std::move(vec)) {}
+
+    virtual std::ostream& print(std::ostream& os) override {
+        os << "[";
+        for(size_t i = 0; i < vec.size(); i++) {
+            if(i > 0) os << ", ";
+            os << vec[i];
+        }
+        os << "]";
+        return os;
+    }
+
+    virtual std::unique_ptr<Obj> copy() override {
+        return std::make_unique<PackedArr>(vec);
+    }
+};
+
+using IntArr = PackedArr<int64_t, TypeTag::INT_ARR>;
+using FltArr = PackedArr<double, TypeTag::FLT_ARR>;
+
 class ExeArr : public Arr {
 public:
-    PfixDictionary dictionary;
+    PfixEnvironment env;
+    std::shared_ptr<Code> code;
 
-    ExeArr(std::vector<std::unique_ptr<Obj>>&& vec, PfixDictionary dictionary = PfixDictionary())
-        : Arr(std::move(vec)), dictionary(dictionary) {
+    ExeArr(std::vector<Value>&& vec, PfixEnvironment env = nullptr)
+        : Arr(std::move(vec)), env(std::move(env)) {
         this->tag = TypeTag::EXE_ARR;
     }
 
-    void add_dictionary(PfixDictionary dictionary) {
-        this->dictionary = dictionary;
+    ExeArr(std::deque<Value>&& vec, PfixEnvironment env = nullptr)
+        : Arr(std::move(vec)), env(std::move(env)) {
+        this->tag = TypeTag::EXE_ARR;
     }
 
-    virtual std::unique_ptr<Obj> copy() override {
-        std::vector<std::unique_ptr<Obj>> copy_vec;
-        std::transform(vec.begin(), vec.end(), std::back_inserter(copy_vec), [](auto& x) {
-            return x->copy();
-        });
+    void capture(PfixEnvironment env) {
+        this->env = std::move(env);
+    }
 
-        return std::make_unique<ExeArr>(std::move(copy_vec), dictionary);
+    virtual std::unique_ptr<Obj> copy() override {
+        std::deque<Value> copy_vec(vec);
+        auto exe_arr = std::make_unique<ExeArr>(std::move(copy_vec), env);
+        exe_arr->code = code;
+        return exe_arr;
     }
 };
 
@@ -224,17 +441,27 @@ public:
 
 class Sym : public Obj {
 public:
-    std::string str;
-    Sym(const std::string& str) : Obj(TypeTag::SYM), str(str) {}
-    // Sym(const char* c) : Obj(TypeTag::SYM), str(c) {}
+    SymbolId id;
+
+    // Taken from the name when the symbol is created, so evaluating it
+    // does not look into the symbol table shared by all threads
+    bool literal;   // see is_literal_symbol
+    bool store;     // name! binds name
+
+    Sym(SymbolId id) : Sym(id, symbol_name(id)) {}
+    Sym(std::string_view str) : Sym(intern(str), str) {}
+    Sym(SymbolId id, std::string_view str) : Sym(id, is_literal_symbol(str), str.size() > 1 && str.back() == '!') {}
+    Sym(SymbolId id, bool literal, bool store) : Obj(TypeTag::SYM), id(id), literal(literal), store(store) {}
+
+    const std::string& str() const { return symbol_name(id); }
 
     virtual std::ostream& print(std::ostream& os) override {
-        os << str;
+        os << str();
         return os;
     }
 
     virtual std::unique_ptr<Obj> copy() override {
-        return std::make_unique<Sym>(str);
+        return std::make_unique<Sym>(id, literal, store);
     }
 };
 
@@ -242,16 +469,38 @@ class NativeSym : public Obj {
 public:
     PfixStackFunction function;
 
-    NativeSym(PfixStackFunction function)
-        : Obj(TypeTag::NATIVE_SYM), function(function) {}
+    // Whether the result only depends on the arguments, so calls on
+    // constants may be evaluated at compile time
+    bool pure = false;
+
+    // Set for natives of extensions, which are called directly
+    std::shared_ptr<const PfixExtensionNative> extension;
+
+    NativeSym(PfixStackFunction function, bool pure = false)
+        : Obj(TypeTag::NATIVE_SYM), function(function), pure(pure) {}
+
+    NativeSym(std::shared_ptr<const PfixExtensionNative> extension, bool pure)
+        : Obj(TypeTag::NATIVE_SYM),
+          function([extension](PfixStack* s) { call_extension(*s, *extension); }),
+          pure(pure), extension(std::move(extension)) {}
+
+    void call(PfixStack* s) {
+        if(extension) {
+            call_extension(*s, *extension);
+        } else {
+            function(s);
+        }
+    }
 
     virtual std::ostream& print(std::ostream& os) override {
-        std::cout << "native";
+        os << "native";
         return os;
     }
 
     virtual std::unique_ptr<Obj> copy() override {
-        return std::make_unique<NativeSym>(function);
+        auto native = std::make_unique<NativeSym>(function, pure);
+        native->extension = extension;
+        return native;
     }
 };
 
@@ -0,0 +1,53 @@
+#include <iostream>
+#include <cstring>
+
+#include "../src/interpreter.hpp"
+
+// Checks behind make test for instructions that no script compiles to.
+// Every check runs hand-written code and expects it to fail with a message.
+
+struct Check {
+    std::string name;
+    std::vector<Instruction> instructions;
+    std::vector<Value> constants;
+    std::string error;
+};
+
+bool run(const Check& check) {
+    PfixInterpreter interp;
+    interp.load_builtins();
+
+    auto code = std::make_shared<Code>();
+    for(auto& it : check.constants) code->add_constant(it);
+    for(auto& it : check.instructions) code->emit(it.op, it.arg);
+
+    try {
+        interp.run_block(code);
+        std::cout << "FAIL " << check.name << ": no error" << std::endl;
+    } catch(const std::exception& e) {
+        if(e.what() == check.error) return true;
+        std::cout << "FAIL " << check.name << ": " << e.what() << std::endl;
+    }
+    return false;
+}
+
+int main() {
+    // TypedOp past NOT_EQUAL, int_op has no result for it
+    uint32_t invalid = uint32_t(TypedOp::NOT_EQUAL) + 1;
+
+    std::vector<Check> checks = {
+        {"int op", {{OpCode::PUSH_CONST, 0}, {OpCode::PUSH_CONST, 1}, {OpCode::INT_OP, invalid}},
+            {Value(7), Value(2)}, "Invalid integer operation"},
+        {"int const op", {{OpCode::PUSH_CONST, 0}, {OpCode::INT_CONST_OP, 1 << 8 | invalid}},
+            {Value(7), Value(2)}, "Invalid integer operation"},
+        {"flt op", {{OpCode::PUSH_CONST, 0}, {OpCode::PUSH_CONST, 1}, {OpCode::FLT_OP, invalid}},
+            {Value(7.0), Value(2.0)}, "Invalid typed operation"},
+    };
+
+    size_t failed = 0;
+    for(auto& check : checks) {
+        if(!run(check)) failed++;
+    }
+    std::cout << "bytecode: " << checks.size() - failed << " passed, " << failed << " failed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Runs every script in tests/ with each binary given and compares the output
+# with the .out file next to it, e.g. sh tests/run.sh ./pfix ./pfix-jit
+cd "$(dirname "$0")/.." || exit 1
+
+status=0
+for bin in "$@"; do
+    passed=0
+    failed=0
+    for script in tests/*.pf; do
+        expected="${script%.pf}.out"
+        if "$bin" "$script" 2>&1 | diff -u "$expected" - > /dev/null; then
+            passed=$((passed + 1))
+        else
+            echo "FAIL $bin $script"
+            "$bin" "$script" 2>&1 | diff -u "$expected" -
+            failed=$((failed + 1))
+        fi
+    done
+    echo "$bin: $passed passed, $failed failed"
+    [ "$failed" -eq 0 ] || status=1
+done
+exit $status